@@ -37,6 +37,7 @@ from elf_parser import do_elf
 from elf_parser import save_chunk
 from coverage import CoverageStatusQemu
 from paths import TranslatorPaths
+from scheduler import EntryScheduler, SharedStore
 
 logging.basicConfig()
 log = logging.getLogger("bin2llvm")
@@ -48,28 +49,76 @@ def get_new_discovered_from_json(path):
     except:
         return []
 
-def merge_arm_thumb_bit(dst_file, srca_file, srcb_file):
+def load_arm_thumb_bit(src_file):
+    if src_file is None:
+        return set([])
     try:
-        with open(srca_file, 'rb') as f:
-            a = set(json.loads(f.read()))
+        with open(src_file, 'rb') as f:
+            return set(json.loads(f.read()))
     except (IOError, ValueError):
-        a = set([])
+        return set([])
+
+def merge_arm_thumb_bit(dst_file, srca_file, srcb_file):
+    a = load_arm_thumb_bit(srca_file)
+    b = load_arm_thumb_bit(srcb_file)
+    with open(dst_file, 'wb') as f:
+        f.write(json.dumps(sorted(a.union(b))))
+
+# The journal is rewritten after each committed job, so --resume starts
+# again after the last one. It is replaced with a rename, and the
+# coverage and thumb files it names are new for every job, so a crash
+# leaves either the old journal or the new one, never half of it.
+JOURNAL_FILE = 'journal.json'
+
+def write_journal(temp_dir, scheduler, store, func_bcs):
+    seq, head = scheduler.resume_point()
+    cov_file = 'journal-coverage-%d.bin' % seq
+    thumb_file = 'journal-thumb-%d.json' % seq
+    store.cov.save(os.path.join(temp_dir, cov_file))
+    with open(os.path.join(temp_dir, thumb_file), 'wb') as f:
+        f.write(json.dumps(sorted(store.thumb_bits)))
+    journal = {
+        'seq': seq,
+        'head': head,
+        'entries': store.entries,
+        'coverage': cov_file,
+        'thumb': thumb_file,
+        'func_bcs': [os.path.relpath(bc, temp_dir) for bc in func_bcs],
+        'file': [os.path.abspath(f) for f in args.file],
+    }
+    path = os.path.join(temp_dir, JOURNAL_FILE)
+    with open(path + '.tmp', 'wb') as f:
+        f.write(json.dumps(journal))
+    os.rename(path + '.tmp', path)
+    # the files of the previous journal
+    for old in os.listdir(temp_dir):
+        if old.startswith('journal-') and \
+                old not in [cov_file, thumb_file]:
+            try:
+                os.remove(os.path.join(temp_dir, old))
+            except OSError:
+                pass
+
+def read_journal(temp_dir):
+    """the journal as a dict, with absolute paths, or None"""
     try:
-        with open(srcb_file, 'rb') as f:
-            b = set(json.loads(f.read()))
+        with open(os.path.join(temp_dir, JOURNAL_FILE), 'rb') as f:
+            journal = json.loads(f.read())
     except (IOError, ValueError):
-        b = set([])
-    with open(dst_file, 'wb') as f:
-        f.write(json.dumps(list(a.union(b))))
+        return None
+    for key in ['coverage', 'thumb']:
+        journal[key] = os.path.join(temp_dir, journal[key])
+    journal['func_bcs'] = [os.path.join(temp_dir, bc) \
+            for bc in journal['func_bcs']]
+    return journal
 
 def run_translator(tmp_dir, machine_path,
-        translator_cfg_path, cnt=0):
+        translator_cfg_path, cnt=0, work_dir=None, in_asm=False):
     if log.getEffectiveLevel() == logging.DEBUG:
         console = open(os.path.join(tmp_dir, 'run_translator.log'), 'at')
     else:
         console = open(os.devnull, 'w')
     ret = True
-    curr_path = os.getcwd()
     cmd = ''
     cmd += translator_path + ' '
     # -L path, path should contain the op_helper.bc file
@@ -77,12 +126,15 @@ def run_translator(tmp_dir, machine_path,
     cmd += "-M configurable -kernel %s " % machine_path
     cmd += "-nographic -monitor /dev/null -net none "
     cmd += "-s2e-config-file %s " % translator_cfg_path
-    cmd += "-s2e-verbose -generate-llvm -D %s -d in_asm" % \
-            (os.path.join(tmp_dir, 'qemu-%d.log' % cnt))
+    cmd += "-s2e-verbose -generate-llvm"
+    if in_asm:
+        # the coverage comes from coverageOut, this is for debugging
+        cmd += " -D %s -d in_asm" % \
+                (os.path.join(tmp_dir, 'qemu-%d.log' % cnt))
     log.debug('run_translator: "%s"' % cmd)
-    os.chdir(tmp_dir)
     try:
-        subprocess.check_call(cmd.split(' '), \
+        # s2e-last is created in the working directory
+        subprocess.check_call(cmd.split(' '), cwd=(work_dir or tmp_dir), \
                 stdout=console, stderr=console)
     except subprocess.CalledProcessError:
         log.debug('run_translator failed: ' + cmd)
@@ -94,14 +146,20 @@ def run_translator(tmp_dir, machine_path,
             console.close()
         except:
             pass
-    os.chdir(curr_path)
     return ret
 
-def get_replace_pass_cfg(cfg):
+def get_memory_pass_cfg(cfg):
     ret = ''
     for seg in cfg['segments']:
-        ret += '-memory %s@0x%08x ' % \
-                (seg['file'], seg['address'])
+        # loads from read-only segments can be folded by the fixpoint
+        opt = '-memory-ro' if seg.get('readonly', False) else '-memory'
+        ret += '%s %s@0x%08x ' % \
+                (opt, seg['file'], seg['address'])
+    return ret
+
+def get_replace_pass_cfg(cfg):
+    ret = get_memory_pass_cfg(cfg)
+    ret += '-constant-fixpoint '
     return ret
 
 def init_path(endianness='little'):
@@ -114,6 +172,7 @@ def init_path(endianness='little'):
     global link_path
     global translator_path
     global linker_path
+    global pipeline_path
     global path_ll_for_helpers
     global linker_lib
 
@@ -123,10 +182,12 @@ def init_path(endianness='little'):
     link_path = P.get_llvm_link()
     translator_path = P.get_qemu(endianness)
     linker_path = P.get_linker()
+    pipeline_path = P.get_pipeline()
     path_ll_for_helpers = P.get_ll_helpers()
     linker_lib = P.get_lib()
 
-def run_passes_pre(raw_llvm, out_funcs, out_remaining, cfg, jump_table_file=None):
+def run_passes_pre(raw_llvm, out_funcs, out_remaining, cfg, jump_table_file=None,
+        outline_shared=False, build_threads=1):
     if log.getEffectiveLevel() == logging.DEBUG:
         console = open(os.path.join(os.path.dirname(out_funcs), 'run_passes_pre.log'), 'at')
     else:
@@ -141,9 +202,7 @@ def run_passes_pre(raw_llvm, out_funcs, out_remaining, cfg, jump_table_file=None
     #cmd +=  "-s2edeleteinstructioncount "
     #cmd +=  "-dce "
     #cmd +=  "-fixoverlappedbbs "
-    cmd += "-tag-inst-pc "
-    cmd += "-rmexterstoretopc "
-    cmd += "-s2edeleteinstructioncount "
+    cmd += "-track-inst-pc "
     cmd +=  "-fixoverlappedbbs "
     #cmd += "-fix-overlaps "
     cmd += "-dce "
@@ -153,15 +212,15 @@ def run_passes_pre(raw_llvm, out_funcs, out_remaining, cfg, jump_table_file=None
         cmd +=  "-replaceconstantloads %s" % (replace_cst_cfg)
     else:
         cmd +=  "-replaceconstantloads -jump-table-info %s %s" % (jump_table_file, replace_cst_cfg)
-    cmd +=  "-dce "
-    cmd +=  "-armmarkcall "
     cmd +=  "-dce -gvn -dce "
-    cmd +=  "-armmarkreturn "
-    cmd +=  "-armmarkjumps "
-    cmd +=  "-markfuncentry "
+    cmd +=  "-armclassifycf "
     cmd +=  "-rmbranchtrace "
     if cfg['endianness'] != 'little':
         cmd += "-is-big-endian "
+    if outline_shared:
+        cmd += "-outline-shared-bbs "
+    if build_threads > 1:
+        cmd += "-buildfunctions-threads %d " % build_threads
     cmd +=  "-buildfunctions -save-funcs %s " % out_funcs
 
     cmd += "%s -o %s" % (raw_llvm, out_remaining)
@@ -190,6 +249,8 @@ def run_passes_post(in_bc, out_bc):
     cmd += '-load %s ' % so_path
     cmd += "-dce "
     cmd += "-internalize-globals "
+    cmd += "-dead-flags "
+    cmd += "-dce "
     cmd += "-basicaa "
     cmd += "-sink "
     cmd += "-constprop "
@@ -198,6 +259,11 @@ def run_passes_post(in_bc, out_bc):
     cmd += "-funcrename "
     cmd += "-alias-global-bb "
     cmd += "-dce "
+    # keep the registers of each function in SSA values
+    cmd += "-promote-regs "
+    cmd += "-mem2reg "
+    cmd += "-dse "
+    cmd += "-dce "
     cmd += "%s -o %s" % (in_bc, out_bc)
 
     try:
@@ -213,40 +279,58 @@ def run_passes_post(in_bc, out_bc):
             pass
     return True
 
-def run_indirect_solver(in_bc, out_bc, out_new_targets_json):
-    # run opt -gvn -basicaa
+def run_pipeline(raw_llvm, out_funcs, out_funcs_indirect, \
+        out_targets_funcs_json, out_targets_remaining_json, out_thumb_json, \
+        cfg, jump_table_file=None, outline_shared=False, build_threads=1):
+    # run_passes_pre, both run_indirect_solver and run_arm_dump_thumb_bit
+    # in one process, on a single parse of raw_llvm
     if log.getEffectiveLevel() == logging.DEBUG:
-        console = open(os.path.join(os.path.dirname(in_bc), 'run_indirect_solver.log'), 'at')
+        console = open(os.path.join(os.path.dirname(out_funcs), 'run_pipeline.log'), 'at')
     else:
         console = open(os.devnull, 'w')
-    opt_bc = out_bc+'.opt.for.insidrect.bc'
-
     cmd = ''
-    cmd += opt_path + ' '
-    cmd += "-load %s " % so_path
-
-    cmd += "-gvn "
-    cmd += "-basicaa "
-    cmd += "%s -o %s" % (in_bc, opt_bc)
+    cmd += pipeline_path + ' '
+    if jump_table_file is not None:
+        cmd += "-jump-table-info %s " % jump_table_file
+    cmd += get_replace_pass_cfg(cfg)
+    if cfg['endianness'] != 'little':
+        cmd += "-is-big-endian "
+    if outline_shared:
+        cmd += "-outline-shared-bbs "
+    if build_threads > 1:
+        cmd += "-buildfunctions-threads %d " % build_threads
+    cmd += "-save-funcs %s " % out_funcs
+    cmd += "-funcs-indirect-out %s " % out_funcs_indirect
+    cmd += "-funcs-targets %s " % out_targets_funcs_json
+    cmd += "-remaining-targets %s " % out_targets_remaining_json
+    cmd += "-thumb-out %s " % out_thumb_json
+    cmd += raw_llvm
 
     try:
         subprocess.check_call(cmd.split(' '), \
                 stdout = console, stderr = console)
-    except subprocess.CalledProcessError:
-        log.debug("run_indirect_solver (opt) failed: " + cmd)
+    except (subprocess.CalledProcessError, OSError):
+        log.debug("run_pipeline failed: " + cmd)
         return False
     finally:
         try:
             console.close()
         except:
             pass
+    return True
 
-    # run our custom pass
+def run_indirect_solver(in_bc, out_bc, out_new_targets_json, cfg=None):
+    # the solver runs -basicaa -gvn on an in-memory clone of in_bc
     cmd = ''
     cmd += opt_path + ' '
     cmd += "-load %s " % so_path
-    cmd += "-solveindirectsingle -optfile %s -solvedfile %s " % \
-            (opt_bc, out_new_targets_json)
+    cmd += "-solveindirectsingle -solvedfile %s " % \
+            (out_new_targets_json)
+    # the value-set analysis reads constant pools from the images
+    if cfg is not None:
+        cmd += get_memory_pass_cfg(cfg)
+        if cfg['endianness'] != 'little':
+            cmd += "-is-big-endian "
     cmd += "-dce "
     cmd += "%s -o %s" % (in_bc, out_bc)
 
@@ -325,7 +409,7 @@ def generate_helper_bc(temp_dir):
             pass
 
 
-def run_inline_mmu_helpers(temp_dir, in_bc, out_bc):
+def run_inline_mmu_helpers(temp_dir, in_bc, out_bc, addrmap=None):
 
     cmd = ''
     cmd += link_path + ' '
@@ -352,6 +436,10 @@ def run_inline_mmu_helpers(temp_dir, in_bc, out_bc):
     cmd = ''
     cmd += opt_path + ' '
     cmd += '-always-inline '
+    if addrmap:
+        # from the saved module, the helpers are in its function list
+        cmd += '-load %s ' % so_path
+        cmd += '-write-addrmap -addrmap %s ' % addrmap
     cmd += linked_bc_no_opt + ' '
     cmd += '-o ' + out_bc
     if log.getEffectiveLevel() == logging.DEBUG:
@@ -372,13 +460,19 @@ def run_inline_mmu_helpers(temp_dir, in_bc, out_bc):
 
     return True
 
-def run_custom_linker(linker_path, func_bcs, out_file):
+def run_custom_linker(linker_path, func_bcs, out_file, threads=1, \
+        incremental=False):
     if log.getEffectiveLevel() == logging.DEBUG:
         console = open(os.path.join(os.path.dirname(out_file), 'run_custom_linker.log'), 'at')
     else:
         console = open(os.devnull, 'w')
     cmd = ''
     cmd += linker_path + ' '
+    if threads > 1:
+        cmd += '-j %d ' % threads
+    if incremental:
+        # out_file is extended in place, with its .index and .pending
+        cmd += '--incremental '
     cmd += ' '.join(func_bcs)
     cmd += ' ' + out_file
 
@@ -450,7 +544,8 @@ def write_tranlator_cfg(dst_path, segments, \
         already_file=None, \
         isThumbIn=None, \
         isThumbOut=None, \
-        jumpTableInfoPath=None):
+        jumpTableInfoPath=None, \
+        coverageOut=None):
     constantMemoryRanges = "\tconstantMemoryRanges = {\n"
     for s in segments:
         constantMemoryRanges += """\t\t%s = {
@@ -490,12 +585,14 @@ pluginsConfig = {
         %s
         %s
         %s
+        %s
     }
 }
 """ % (pairIfNotNone('initialAlreadyVisited', already_file),\
         pairIfNotNone('isThumbIn', isThumbIn), \
         pairIfNotNone('isThumbOut', isThumbOut), \
         pairIfNotNone('jumpTableInfoPath', jumpTableInfoPath), \
+        pairIfNotNone('coverageOut', coverageOut), \
         constantMemoryRanges)
     log.debug("[Translator] Saving translator cfg to: %s" % dst_path)
     with open(dst_path, 'wt') as f:
@@ -521,6 +618,8 @@ def do_raw_arm_one(path_to_raw, load_address):
     segm_desc['size'] = padded_size
     segm_desc['address'] = load_address
     segm_desc['name'] = 'file_%08x' % load_address
+    # no permissions in a raw image, assume code and literal pools
+    segm_desc['readonly'] = True
 
     return segm_desc
 
@@ -554,6 +653,103 @@ def write_configs(machine_file, translator_file, cfg):
             cfg['endianness'], cfg['entry_address'], cfg['segments'])
     write_tranlator_cfg(translator_file, cfg['segments'])
 
+def harvest_entry(job, cfg):
+    """run the translator from job.entry. Its configuration and s2e
+    output go to a directory of its own, the rest is numbered as before"""
+    cnt = job.seq
+    job_dir = os.path.join(args.temp_dir, 'job-%d' % cnt)
+    if not os.path.isdir(job_dir):
+        os.makedirs(job_dir)
+    log.info("Use entry: 0x%08x (job %d)" % (job.entry, cnt))
+    machine_file = os.path.join(job_dir, 'machine.json')
+    translator_file = os.path.join(job_dir, 'translator.json')
+    write_machine_cfg(machine_file, \
+            cfg['architecture'], cfg['cpu_model'], \
+            cfg['endianness'], job.entry, cfg['segments'])
+    already_file = os.path.join(args.temp_dir, 'already-explored-%d.bin' % cnt)
+    job.snapshot.cov.save(already_file)
+    isThumbIn = None
+    if len(job.snapshot.thumb_bits):
+        isThumbIn = os.path.join(args.temp_dir, 'is-thumb-in-%d.json' % cnt)
+        with open(isThumbIn, 'wt') as f:
+            f.write(json.dumps(sorted(job.snapshot.thumb_bits)))
+    isThumbOut = os.path.join(args.temp_dir, 'is-thumb-out-%d.json' % cnt)
+    coverage_file = os.path.join(args.temp_dir, 'coverage-%d.bin' % cnt)
+    write_tranlator_cfg(translator_file, cfg['segments'], \
+            already_file, \
+            isThumbIn, \
+            isThumbOut, \
+            args.jump_table_file, \
+            coverage_file
+            )
+    log.debug("[translator] already explored %d (intervals)" % len(job.snapshot.cov))
+
+    ok = run_translator(args.temp_dir, machine_file, translator_file, cnt, \
+            job_dir, args.qemu_log)
+    if ok is False:
+        log.warning("(initial) crashed with entry: 0x%08x" % job.entry)
+
+    ret = {
+        'dir': job_dir,
+        'coverage': coverage_file,
+        'qemu_log': os.path.join(args.temp_dir, 'qemu-%d.log' % cnt),
+        'thumb_out': isThumbOut,
+    }
+    ret['cov'] = CoverageStatusQemu()
+    extend_coverage(ret['cov'], ret)
+    return ret
+
+def extend_coverage(cov, harvest):
+    """add what the translator lifted, the in_asm log is only read when
+    the coverage file is missing (a translator without coverageOut)"""
+    try:
+        cov.extend_with_coverage_file(harvest['coverage'])
+        return
+    except (IOError, ValueError):
+        pass
+    try:
+        cov.extend_with_qemu_log(harvest['qemu_log'])
+    except IOError:
+        pass
+
+def run_entry_passes(job, cfg):
+    """the pass chain on what job harvested, pipey or the opt runs"""
+    cnt = job.seq
+    ret = {}
+    ret['funcs'] = os.path.join(args.temp_dir, 'funcs-%d.bc' % cnt)
+    out_remaining = os.path.join(args.temp_dir, 'remaining-%d.bc' % cnt)
+    ret['funcs_indirect'] = os.path.join(args.temp_dir, 'funcs-indirect-%d.bc' % cnt)
+    out_remaining_indirect = os.path.join(args.temp_dir, 'remaining-indirect-%d.bc' % cnt)
+    ret['targets_funcs'] = os.path.join(args.temp_dir, 'new-targets-funcs-%d.json' % cnt)
+    ret['targets_remaining'] = os.path.join(args.temp_dir, 'new-targets-remaining-%d.json' % cnt)
+    ret['thumb'] = os.path.join(args.temp_dir, \
+            'arm-thumb-funcs-unmerged-%d.json' % cnt)
+
+    raw_llvm = os.path.join(job.harvest['dir'], 's2e-last', 'translated_bbs.bc')
+    ok_pre = ok = False
+    if use_pipeline:
+        ok_pre = ok = run_pipeline(raw_llvm, ret['funcs'], \
+                ret['funcs_indirect'], ret['targets_funcs'], \
+                ret['targets_remaining'], ret['thumb'], \
+                cfg, args.jump_table_file, args.outline_shared, \
+                args.build_threads)
+        if ok is False:
+            log.warning("(pipeline) crashed with entry: 0x%08x, using opt" % job.entry)
+    if not ok_pre:
+        ok_pre = run_passes_pre(raw_llvm, ret['funcs'], \
+                out_remaining, cfg, args.jump_table_file, \
+                args.outline_shared, args.build_threads)
+        # run indirect solver
+        ok = run_indirect_solver(ret['funcs'],\
+                ret['funcs_indirect'], ret['targets_funcs'], cfg)
+        run_indirect_solver(out_remaining,\
+                out_remaining_indirect, ret['targets_remaining'], cfg)
+        run_arm_dump_thumb_bit(\
+                ret['funcs_indirect'], ret['thumb'])
+    ret['ok_pre'] = ok_pre
+    ret['ok'] = ok
+    return ret
+
 should_continue = True
 import signal
 import sys
@@ -599,10 +795,35 @@ def main():
             help="Remove ${tmp_dir}/lock file when done.")
     parser.add_argument("--thumb-bits-file", "-t", required=False, \
             help="Json file with a list of entries that we know that are in thumb mode")
+    parser.add_argument("--outline-shared", action='store_true', \
+            default=False,
+            help="Emit blocks shared by several functions only once.")
+    parser.add_argument("--build-threads", type=int, default=1, \
+            help="Threads used to build the functions of an iteration.")
+    parser.add_argument("--link-threads", type=int, default=1, \
+            help="Threads used by the linker to load its inputs.")
+    parser.add_argument("--incremental-link", action='store_true', \
+            default=False,
+            help="Link the functions of each iteration as soon as they are built.")
+    parser.add_argument("--harvest-workers", type=int, default=1, \
+            help="Entries harvested by the translator at the same time.")
+    parser.add_argument("--pass-workers", type=int, default=1, \
+            help="Harvested entries run through the passes at the same time.")
+    parser.add_argument("--qemu-log", action='store_true', \
+            default=False,
+            help="Keep the QEMU in_asm log of each entry in qemu-N.log.")
+    parser.add_argument("--no-pipeline", action='store_true', \
+            default=False,
+            help="Run the passes of each iteration with opt instead of pipey.")
+    parser.add_argument("--resume", action='store_true', \
+            default=False,
+            help="Continue the run journaled in --temp-dir.")
 
     global args
     args = parser.parse_args()
     #print args
+    if args.resume and args.temp_dir is None:
+        parser.error("--resume needs --temp-dir")
 
     if args.temp_dir is None:
         args.temp_dir = tempfile.mkdtemp(prefix='bin2llvm-', dir=args.temp_dir_base)
@@ -661,12 +882,32 @@ def main():
 
     log.debug("[Translator] Using entry(s): %s" % (map(hex, cfg['entry_address'])))
 
-    # write cfgs
-    machine_file = os.path.join(args.temp_dir, 'machine.json')
-    translator_file = os.path.join(args.temp_dir, 'translator.json')
+    if args.out is None:
+        final_linked = os.path.join(args.temp_dir, 'final-linked.bc')
+        args.out = os.path.join(args.temp_dir, 'final.bc')
+    else:
+        final_linked = os.path.join(args.temp_dir,
+                os.path.basename(args.out)+'.linked.bc')
+
+    journal = None
+    if args.resume:
+        journal = read_journal(args.temp_dir)
+        if journal is None:
+            log.warning("[Translator] no journal in %s, starting over" % \
+                    args.temp_dir)
+        elif journal['file'] != [os.path.abspath(f) for f in args.file]:
+            # its queue, coverage and func bcs are of another input
+            parser.error("the journal in %s is for %s" % \
+                    (args.temp_dir, ' '.join(journal['file'])))
+
+    if args.incremental_link and journal is None:
+        # start from an empty linked module
+        for ext in ['', '.index', '.pending', '.fcnt']:
+            try:
+                os.remove(final_linked + ext)
+            except OSError:
+                pass
 
-    cov = CoverageStatusQemu()
-    cnt = 0
     func_bcs = []
     try:
         isThumbIn
@@ -678,123 +919,87 @@ def main():
             log.warning("[Translator] override thumb bits by the readelf")
         isThumbIn = os.path.abspath(args.thumb_bits_file)
 
-    #entryQueue = [0x00008b60] + cfg['entry_address']
-    entryQueue = cfg['entry_address']
-    #entryQueue = [0x00008c98]
-    head = 0
     global should_continue
     should_continue = True
     init_path(cfg['endianness'])
-    while head < len(entryQueue) and should_continue:
-        #log.info("addresses visited: " + str(len(cov.getAlreadyExplored())))
-        e = entryQueue[head]
-        head += 1
-        if cov.visited(e):
-            log.debug("[Translator] already visited 0x%08x" % e)
-            continue
-        #write_configs(machine_file, translator_file, cfg, alreadyExplored)
-        log.info("Use entry: 0x%08x" % (e))
-        alreadyExplored = cov.get_already_explored_intervals()
-        write_machine_cfg(machine_file, \
-                cfg['architecture'], cfg['cpu_model'], \
-                cfg['endianness'], e, cfg['segments'])
-        already_file = os.path.join(args.temp_dir,\
-                'already-explored-%d.json' % cnt)
-        with open(already_file, 'wt') as f:
-            f.write(json.dumps(alreadyExplored))
-        isThumbOut = os.path.join(args.temp_dir,\
-                'is-thumb-out-%d.json' % cnt)
-        write_tranlator_cfg(translator_file, cfg['segments'], \
-                already_file, \
-                isThumbIn, \
-                isThumbOut, \
-                args.jump_table_file
-                )
-        log.debug("[translator] already explored %d (intervals)" % len(alreadyExplored))
-
-        # run translator
-        if cfg['endianness'] == 'little':
-            pass
-        else:
-            #translator_path = translator_path_build_dir + \
-            #        '/qemu-debug/armeb-s2e-softmmu/qemu-system-armeb'
-            #raise Exception("N/A")
-            pass
-        ok = run_translator(args.temp_dir, machine_file, \
-                translator_file, cnt)
-        if ok is False:
-            log.warning("(initial) crashed with entry: 0x%08x" % e)
-
-        # run passes
-        out_funcs = os.path.join(args.temp_dir, 'funcs-%d.bc' % cnt)
-        out_remaining = os.path.join(args.temp_dir, 'remaining-%d.bc' % cnt)
+    global use_pipeline
+    use_pipeline = not args.no_pipeline and os.path.exists(pipeline_path)
 
-        raw_llvm = os.path.join(args.temp_dir, 's2e-last', 'translated_bbs.bc')
-        ok = run_passes_pre(raw_llvm, out_funcs, \
-                out_remaining, cfg, args.jump_table_file)
+    def commit_entry(job, store):
+        """publish a job, in job order"""
+        e = job.entry
+        if job.harvest is None or job.result is None:
+            log.warning("(passes) crashed with entry: 0x%08x" % e)
+            return
+        res = job.result
         #cov.extend_with_bc(out_funcs)
-        if ok is True:
-            qemu_path_file = os.path.join(args.temp_dir, 'qemu-%d.log' % cnt)
-            cov.extend_with_qemu_log(qemu_path_file)
+        if res['ok_pre'] is True:
+            extend_coverage(store.cov, job.harvest)
 
+        store.add_entries(get_new_discovered_from_json(res['targets_funcs']))
 
-        out_funcs_indirect = os.path.join(args.temp_dir, 'funcs-indirect-%d.bc' % cnt)
-        out_remaining_indirect = os.path.join(args.temp_dir, 'remaining-indirect-%d.bc' % cnt)
-        out_new_targets_funcs_json = os.path.join(args.temp_dir, 'new-targets-funcs-%d.json' % cnt)
-        out_new_targets_remaining_json = os.path.join(args.temp_dir, 'new-targets-remaining-%d.json' % cnt)
-        # run indirect solver
-
-        ok = run_indirect_solver(out_funcs,\
-                out_funcs_indirect, out_new_targets_funcs_json)
-        new_discovered = get_new_discovered_from_json(out_new_targets_funcs_json)
-        for b in new_discovered:
-            if not cov.visited(b):
-                entryQueue.append(b)
-
-        if ok is False:
+        if res['ok'] is False:
             log.warning("(passes) crashed with entry: 0x%08x" % e)
         else:
             #cov.extend_with_bc(out_remaining)
-            func_bcs.append(out_funcs_indirect)
-        func_bcs.append(out_funcs)
-
-        run_indirect_solver(out_remaining,\
-                out_remaining_indirect, out_new_targets_remaining_json)
-
-        new_discovered = get_new_discovered_from_json(out_new_targets_remaining_json)
-        for b in new_discovered:
-            if not cov.visited(b):
-                entryQueue.append(b)
-
-        out_funcs_arm_thumb_json = os.path.join(args.temp_dir, \
-                'arm-thumb-funcs-unmerged-%d.json' % cnt)
-        run_arm_dump_thumb_bit(\
-                out_funcs_indirect, out_funcs_arm_thumb_json)
-        isThumbIn = os.path.join(args.temp_dir, \
-                'arm-thumb-funcs-pcs-%d.json' % cnt)
-        merge_arm_thumb_bit(isThumbIn, \
-                isThumbOut, out_funcs_arm_thumb_json)
+            func_bcs.append(res['funcs_indirect'])
+        func_bcs.append(res['funcs'])
+
+        if args.incremental_link:
+            iteration_bcs = [res['funcs']]
+            if res['ok'] is not False:
+                iteration_bcs.insert(0, res['funcs_indirect'])
+            if not run_custom_linker(linker_path, iteration_bcs, \
+                    final_linked, args.link_threads, True):
+                log.warning("(linker) incremental link failed for entry: 0x%08x" % e)
+
+        store.add_entries(get_new_discovered_from_json(res['targets_remaining']))
+
+        merged_thumb = os.path.join(args.temp_dir, \
+                'arm-thumb-funcs-pcs-%d.json' % job.seq)
+        merge_arm_thumb_bit(merged_thumb, \
+                job.harvest['thumb_out'], res['thumb'])
         # TODO: XXX: take into account the thumb bit
         # we don't really care if this operation succeeded
+        store.thumb_bits |= load_arm_thumb_bit(merged_thumb)
 
-        # next state
-        cnt += 1
-        #isThumbIn = isThumbOut
-
-    log.debug("[Translator] output folder is: %s" % args.temp_dir)
-
-    if args.out is None:
-        final_linked = os.path.join(args.temp_dir, 'final-linked.bc')
-        args.out = os.path.join(args.temp_dir, 'final.bc')
+    start_seq = 0
+    head = 0
+    if journal is None:
+        store = SharedStore(CoverageStatusQemu(), \
+                load_arm_thumb_bit(isThumbIn), cfg['entry_address'])
     else:
-        final_linked = os.path.join(args.temp_dir,
-                os.path.basename(args.out)+'.linked.bc')
+        cov = CoverageStatusQemu()
+        cov.extend_with_coverage_file(journal['coverage'])
+        # the queue as it was, so head still points in it
+        store = SharedStore(cov, load_arm_thumb_bit(journal['thumb']), \
+                journal['entries'])
+        func_bcs.extend(journal['func_bcs'])
+        start_seq = journal['seq']
+        head = journal['head']
+        log.info("[Translator] resuming at job %d, entry %d of %d" % \
+                (start_seq, head, len(store.entries)))
+    scheduler = EntryScheduler(store, \
+            lambda job: harvest_entry(job, cfg), \
+            lambda job, pc: job.harvest['cov'].visited(pc), \
+            lambda job: run_entry_passes(job, cfg), \
+            commit_entry, \
+            args.harvest_workers, args.pass_workers, \
+            lambda sched: write_journal(args.temp_dir, sched, store, func_bcs), \
+            start_seq, head)
+    scheduler.run(lambda: should_continue)
 
+    log.debug("[Translator] output folder is: %s" % args.temp_dir)
 
     sys.stdout.flush()
 
 
-    ok = run_custom_linker(linker_path, func_bcs, final_linked)
+    if args.incremental_link:
+        # every iteration was already linked into final_linked
+        ok = os.path.exists(final_linked)
+    else:
+        ok = run_custom_linker(linker_path, func_bcs, final_linked, \
+                args.link_threads)
     function_cnt = 0;
     if ok is False:
         log.warning("(linker) crashed with %s" % ' '.join(func_bcs))
@@ -808,18 +1013,19 @@ def main():
                 (final_linked))
 
 
+    inline_linked = os.path.join(args.temp_dir, args.out)
     if ok:
-        ok_passes_post = run_passes_post(final_linked, args.out+'post_passes.bc')
+        ok_passes_post = run_passes_post(final_linked, \
+                args.out+'post_passes.bc')
         if ok_passes_post:
             log.debug("[Translator] final output is in %s" % \
                     args.out)
         else:
             log.warning("[Translator] passes post failed")
 
-    inline_linked = os.path.join(args.temp_dir, args.out)
     generate_helper_bc(args.temp_dir)
     ok = run_inline_mmu_helpers(args.temp_dir, \
-            args.out+'post_passes.bc', inline_linked)
+            args.out+'post_passes.bc', inline_linked, inline_linked+'.addrmap')
     if ok:
         log.info("FINAL output is in %s (%d functions)" % \
                 (inline_linked, function_cnt))
@@ -0,0 +1,146 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "IntervalSet.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+const char IntervalSet::Magic[8] = { 'B', '2', 'L', 'C', 'O', 'V', '0', '1' };
+
+static void
+writeLE64(std::ostream &os, uint64_t v)
+{
+    char bytes[8];
+    for (int i = 0; i < 8; ++i)
+        bytes[i] = (char)((v >> (8 * i)) & 0xff);
+    os.write(bytes, sizeof(bytes));
+}
+
+static bool
+readLE64(std::istream &is, uint64_t &v)
+{
+    unsigned char bytes[8];
+    if (!is.read((char *)bytes, sizeof(bytes)))
+        return false;
+    v = 0;
+    for (int i = 7; i >= 0; --i)
+        v = (v << 8) | bytes[i];
+    return true;
+}
+
+void
+IntervalSet::insert(uint64_t start, uint64_t end)
+{
+    if (start >= end)
+        return;
+    Map::iterator it = m_intervals.upper_bound(start);
+    if (it != m_intervals.begin()) {
+        Map::iterator prev = it;
+        --prev;
+        if (prev->second >= start) {
+            start = prev->first;
+            end = std::max(end, prev->second);
+            it = prev;
+        }
+    }
+    while (it != m_intervals.end() && it->first <= end) {
+        end = std::max(end, it->second);
+        m_intervals.erase(it++);
+    }
+    m_intervals.insert(it, std::make_pair(start, end));
+}
+
+void
+IntervalSet::merge(const IntervalSet &other)
+{
+    Map merged;
+    const_iterator a = m_intervals.begin(), ae = m_intervals.end();
+    const_iterator b = other.m_intervals.begin(), be = other.m_intervals.end();
+    bool open = false;
+    Interval cur;
+
+    while (a != ae || b != be) {
+        const_iterator next;
+        if (b == be || (a != ae && a->first <= b->first))
+            next = a++;
+        else
+            next = b++;
+        if (open && next->first <= cur.second) {
+            cur.second = std::max(cur.second, next->second);
+            continue;
+        }
+        if (open)
+            merged.insert(merged.end(), cur);
+        cur = *next;
+        open = true;
+    }
+    if (open)
+        merged.insert(merged.end(), cur);
+    m_intervals.swap(merged);
+}
+
+bool
+IntervalSet::contains(uint64_t pc) const
+{
+    const_iterator it = m_intervals.upper_bound(pc);
+    if (it == m_intervals.begin())
+        return false;
+    --it;
+    return pc < it->second;
+}
+
+bool
+IntervalSet::load(const std::string &path)
+{
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    char magic[sizeof(Magic)];
+    if (!in.read(magic, sizeof(magic)) ||
+            memcmp(magic, Magic, sizeof(Magic)))
+        return false;
+    uint64_t cnt;
+    if (!readLE64(in, cnt))
+        return false;
+
+    IntervalSet loaded;
+    for (uint64_t i = 0; i < cnt; ++i) {
+        uint64_t start, end;
+        if (!readLE64(in, start) || !readLE64(in, end))
+            return false;
+        loaded.insert(start, end);
+    }
+    merge(loaded);
+    return true;
+}
+
+bool
+IntervalSet::save(const std::string &path) const
+{
+    std::ofstream out(path.c_str(), std::ios::out | std::ios::binary |
+            std::ios::trunc);
+    if (!out)
+        return false;
+    out.write(Magic, sizeof(Magic));
+    writeLE64(out, m_intervals.size());
+    for (const_iterator it = begin(), ie = end(); it != ie; ++it) {
+        writeLE64(out, it->first);
+        writeLE64(out, it->second);
+    }
+    return out.good();
+}
@@ -0,0 +1,71 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __INTERVAL_SET_H__
+#define __INTERVAL_SET_H__ 1
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+/*
+ * A set of guest addresses kept as disjoint, half-open [start, end)
+ * intervals. Overlapping and adjacent intervals are coalesced when they
+ * are added, so an ARM block followed by a Thumb block (or the other
+ * way around) ends up as one interval.
+ *
+ * contains and insert are logarithmic, merge is linear in both sets.
+ *
+ * The file format is shared by the harvester (coverageOut,
+ * initialAlreadyVisited), covset and bin2llvm.py. All integers are
+ * little-endian:
+ *   char[8]  magic "B2LCOV01"
+ *   u64      count
+ *   count * (u64 start, u64 end), sorted, disjoint, not adjacent
+ */
+class IntervalSet {
+public:
+    typedef std::pair<uint64_t, uint64_t> Interval;
+    /* start -> end */
+    typedef std::map<uint64_t, uint64_t> Map;
+    typedef Map::const_iterator const_iterator;
+
+    static const char Magic[8];
+
+    void insert(uint64_t start, uint64_t end);
+    void merge(const IntervalSet &other);
+    bool contains(uint64_t pc) const;
+    void clear() { m_intervals.clear(); }
+
+    size_t size() const { return m_intervals.size(); }
+    bool empty() const { return m_intervals.empty(); }
+    const_iterator begin() const { return m_intervals.begin(); }
+    const_iterator end() const { return m_intervals.end(); }
+
+    /* return false if path is missing or not an interval set file, the
+     * set is left unchanged then
+     */
+    bool load(const std::string &path);
+    bool save(const std::string &path) const;
+private:
+    Map m_intervals;
+};
+
+#endif
@@ -65,6 +65,8 @@ void RecursiveDescentDisassembler::initialize()
 #endif
     std::string jumpTableInfoPath = s2e()->getConfig()->getString(
             getConfigKey() + ".jumpTableInfoPath", "");
+    m_coverageOut = s2e()->getConfig()->getString(
+            getConfigKey() + ".coverageOut", "");
 
     bool ok;
     std::vector<std::string> rangesKeys = s2e()->getConfig()->getListKeys(getConfigKey() + ".allowedPcRanges", &ok);
@@ -87,7 +89,15 @@ void RecursiveDescentDisassembler::initialize()
         }
     }
 
-    if (initialAlreadyVisited != "") {
+    if (initialAlreadyVisited != "" &&
+            m_visitedPCIntervals.load(initialAlreadyVisited)) {
+        for (IntervalSet::const_iterator i = m_visitedPCIntervals.begin(),
+                ie = m_visitedPCIntervals.end();
+                i != ie;
+                ++i)
+            m_visitedPC[i->first] = true;
+    } else if (initialAlreadyVisited != "") {
+        /* json, [[first, last], ...] with last included */
         std::istream *stream = new
             std::ifstream(initialAlreadyVisited.c_str(), std::ios::in |
                     std::ios::binary);
@@ -110,7 +120,7 @@ void RecursiveDescentDisassembler::initialize()
             // optimize, usually we will get a hit in the hash table
             //
             m_visitedPC[pc_start] = true;
-            m_visitedPCIntervals.push_back(std::make_pair(pc_start, pc_end));
+            m_visitedPCIntervals.insert(pc_start, pc_end + 1);
         }
     }
 
@@ -437,71 +447,37 @@ bool RecursiveDescentDisassembler::explorePCLater(
             m_scheduledPCsMap.find(pc) != m_scheduledPCsMap.end())
         return false;
 
-    if (isPCInVisitedIntervalsBsearch(pc))
+    if (m_visitedPCIntervals.contains(pc))
         return false;
     m_scheduledPCsVector.push_back(pc);
     m_scheduledPCsMap[pc] = true;
     return true;
 }
 
-bool RecursiveDescentDisassembler::isPCInVisitedIntervalsBsearch(
-        uint64_t pc)
+void RecursiveDescentDisassembler::saveCoverage()
 {
-    int a, b;
-    a = 0;
-    b = m_visitedPCIntervals.size()-1;
-    // biggst smaller or eq than pc
-    int idx = -1;
-    int mid = -1;
-    if (a > b)
-        return false;
-    while (a <= b) {
-        int mid = (a+b)/2;
-        if (m_visitedPCIntervals[mid].first == pc) {
-            break;
-        } else if (m_visitedPCIntervals[mid].first > pc) {
-            b = mid-1;
-        } else {
-            a = mid+1;
-        }
+    IntervalSet lifted;
+    for (std::vector<MyTranslationBasicBlock *>::iterator
+            i = m_allBasicBlocks.begin(), ie = m_allBasicBlocks.end();
+            i != ie;
+            ++i)
+        lifted.insert((*i)->m_pcStart, (*i)->m_pcEnd);
+
+    if (!lifted.save(m_coverageOut)) {
+        s2e()->getWarningsStream() << "[RecursiveDescentDisassembler] " <<
+            "unable to write " << m_coverageOut << '\n';
+        return;
     }
-
-    idx = mid;
-
-    // adjust left
-    while (idx >= 0 && m_visitedPCIntervals[idx].first == pc)
-        --idx;
-
-    // linear search while we do not surpass pc
-    while (idx < m_visitedPCIntervals.size()) {
-        if (m_visitedPCIntervals[idx].first <= pc &&
-                pc <= m_visitedPCIntervals[idx].second)
-            return true;
-        if (m_visitedPCIntervals[idx].first > pc)
-            break;
-        ++idx;
-    }
-    return false;
-}
-
-bool RecursiveDescentDisassembler::isPCInVisitedIntervalsLinear(
-        uint64_t pc)
-{
-    int idx = 0;
-    while (idx < m_visitedPCIntervals.size()) {
-        if (m_visitedPCIntervals[idx].first <= pc &&
-                pc <= m_visitedPCIntervals[idx].second)
-            return true;
-        if (m_visitedPCIntervals[idx].first > pc)
-            break;
-        ++idx;
-    }
-    return false;
+    s2e()->getDebugStream() << "[RecursiveDescentDisassembler] " <<
+        lifted.size() << " coverage intervals saved to " << m_coverageOut << '\n';
 }
 
 void RecursiveDescentDisassembler::exit() {
     s2e()->getDebugStream() << "[RecursiveDescentDisassembler] exiting" << '\n';
 
+    if (m_coverageOut != "")
+        saveCoverage();
+
 #ifdef TARGET_ARM
     if (m_isPCThumbOutStream) {
         json::Array root;
@@ -27,6 +27,7 @@
 #include <cajun/json/writer.h>
 
 #include "JumpTableInfo.h"
+#include "IntervalSet.h"
 
 #include <s2e/Plugins/bin2llvm/ExtractPossibleTargetsPass.h>
 #include <s2e/Plugins/bin2llvm/S2ETransformPass.h>
@@ -96,9 +97,8 @@ private:
      */
     std::map<uint64_t, bool> m_visitedPC;
 
-    std::vector< std::pair<uint64_t, uint64_t> > m_visitedPCIntervals;
-    bool isPCInVisitedIntervalsBsearch(uint64_t);
-    bool isPCInVisitedIntervalsLinear(uint64_t);
+    /* explored by the previous runs (initialAlreadyVisited) */
+    IntervalSet m_visitedPCIntervals;
 
     std::map<uint64_t, bool> m_scheduledPCsMap;
     std::vector<uint64_t> m_scheduledPCsVector;
@@ -135,6 +135,12 @@ private:
 
     void exit();
     std::vector<MyTranslationBasicBlock *>m_allBasicBlocks;
+
+    /* coverageOut: the [pcStart, pcEnd) intervals of all the lifted
+     * blocks, saved at exit as an IntervalSet file
+     */
+    std::string m_coverageOut;
+    void saveCoverage();
 };
 
 } // namespace plugins
@@ -23,6 +23,8 @@
 #include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Transforms/Utils/ValueMapper.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Instructions.h>
 #include <llvm/Metadata.h>
 
 #include <s2e/Plugin.h>
@@ -76,19 +78,28 @@ SaveTranslatedBBs::createAndSaveTranslatedBasicBlocksAsAModule(
             llvm::getGlobalContext());
 
     llvm::ValueToValueMapTy valueMap;
+    llvm::LLVMContext &ctx = newModule->getContext();
+    llvm::FunctionType *voidFunctionType =
+        FunctionType::get(llvm::Type::getVoidTy(ctx), false);
+    MDNode *fakeReturn = MDNode::get(ctx, MDString::get(ctx, "true"));
 
     for (std::vector<s2e::plugins::MyTranslationBasicBlock *>::iterator bb =
             allBBs->begin();
             bb != allBBs->end(); ++bb) {
         s2e::plugins::MyTranslationBasicBlock *transBB = *bb;
 
+        /* emit the block with the signature used by the translator
+         * passes: void, no env (null), the returned next TB is dropped
+         */
         llvm::Function *oldFunc = transBB->m_bbFunction;
-        llvm::Constant *c = newModule->getOrInsertFunction(oldFunc->getName(),
-                oldFunc->getFunctionType());
+        llvm::Constant *c = newModule->getOrInsertFunction(
+                "void-" + std::string(oldFunc->getName()),
+                voidFunctionType);
 
         llvm::SmallVector<llvm::ReturnInst *, 5> tempList;
         llvm::Function *newFunc = cast<llvm::Function>(c);
 
+        assert(oldFunc->getArgumentList().size() == 1);
         llvm::Argument *arg0 = oldFunc->getArgumentList().begin();
         llvm::Constant *constant = llvm::ConstantPointerNull::get((llvm::PointerType*)
                 arg0->getType());
@@ -96,6 +107,14 @@ SaveTranslatedBBs::createAndSaveTranslatedBasicBlocksAsAModule(
         copyGlobalReferences(newModule, oldFunc, valueMap);
         llvm::CloneFunctionInto(newFunc, oldFunc, valueMap, true, tempList);
 
+        for (llvm::SmallVector<llvm::ReturnInst *, 5>::iterator
+                ret = tempList.begin();
+                ret != tempList.end(); ++ret) {
+            llvm::ReturnInst *voidRet = llvm::ReturnInst::Create(ctx);
+            voidRet->setMetadata("INS_fakeReturn", fakeReturn);
+            llvm::ReplaceInstWithInst(*ret, voidRet);
+        }
+
         /* add metadata */
         annotateNewFunction(*newFunc, transBB);
 
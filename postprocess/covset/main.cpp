@@ -0,0 +1,102 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * covset reads and writes the interval set files of the harvester
+ * (coverageOut, initialAlreadyVisited) and of bin2llvm.py.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "../translator/IntervalSet.h"
+
+using namespace std;
+
+static void
+usage(char *argv0)
+{
+    cerr << "Usage:\t" << argv0 << " dump set" << endl;
+    cerr << "\t" << argv0 << " stab set pc [pc ...]" << endl;
+    cerr << "\t" << argv0 << " merge out-set set [set ...]" << endl;
+    cerr << "\t" << argv0 << " add out-set start end" << endl;
+    cerr << "\tdump: print the [start, end) intervals" << endl;
+    cerr << "\tstab: print 1 for each pc in the set, 0 otherwise" << endl;
+    cerr << "\tmerge: union of the sets, missing sets are empty" << endl;
+    cerr << "\tadd: add [start, end) to out-set, creating it if needed" << endl;
+}
+
+static bool
+loadOrDie(IntervalSet &set, const char *path)
+{
+    if (set.load(path))
+        return true;
+    cerr << "[covset] unable to load " << path << endl;
+    exit(-1);
+}
+
+static bool
+saveOrDie(const IntervalSet &set, const char *path)
+{
+    if (set.save(path))
+        return true;
+    cerr << "[covset] unable to save " << path << endl;
+    exit(-1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        usage(argv[0]);
+        exit(-1);
+    }
+    std::string cmd(argv[1]);
+    IntervalSet set;
+
+    if (cmd == "dump") {
+        loadOrDie(set, argv[2]);
+        for (auto i = set.begin(), ie = set.end(); i != ie; ++i)
+            printf("0x%08lx 0x%08lx\n", (unsigned long)i->first,
+                    (unsigned long)i->second);
+    } else if (cmd == "stab" && argc >= 4) {
+        loadOrDie(set, argv[2]);
+        for (int i = 3; i < argc; ++i)
+            printf("%d\n", set.contains(strtoull(argv[i], NULL, 0)) ? 1 : 0);
+    } else if (cmd == "merge" && argc >= 4) {
+        for (int i = 3; i < argc; ++i) {
+            IntervalSet other;
+            if (other.load(argv[i]))
+                set.merge(other);
+            else
+                cerr << "[covset] skip " << argv[i] << endl;
+        }
+        saveOrDie(set, argv[2]);
+    } else if (cmd == "add" && argc == 5) {
+        set.load(argv[2]);
+        set.insert(strtoull(argv[3], NULL, 0), strtoull(argv[4], NULL, 0));
+        saveOrDie(set, argv[2]);
+    } else {
+        usage(argv[0]);
+        exit(-1);
+    }
+    return 0;
+}
@@ -25,6 +25,10 @@
 #include <llvm/Module.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/IRReader.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/system_error.h>
+#include <llvm/ADT/OwningPtr.h>
 #include <llvm/Support/SourceMgr.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Scalar.h>
@@ -32,11 +36,22 @@
 #include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/Transforms/Utils/ValueMapper.h>
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 #include <iostream>
+#include <fstream>
+#include <cstdlib>
 
 #include "../translator/FixOverlappedBBs.h"
 #include "../translator/BuildFunctions.h"
+#include "../translator/PCIndex.h"
+#include "../translator/AddressMap.h"
 
 
 using namespace std;
@@ -46,15 +61,36 @@ static void
 usage(char *argv0)
 {
     cerr << "Usage:\t" << argv0 <<
-        "file0.bc [file1.bc [file2.bc ...]] out-file.bc" << endl;
+        " [-j threads] [--incremental] file0.bc [file1.bc [file2.bc ...]]"
+        " out-file.bc" << endl;
     cerr << "\tLink multiple bc files into one" << endl;
+    cerr << "\t--incremental: add to out-file.bc, linking only the new calls"
+        << endl;
+}
+
+/*
+ * The shared functions (BuildFunctions -outline-shared-bbs) are only
+ * reached through the INS_sharedTail calls, and their head may be the
+ * entry of a function too. They are selected and resolved apart from
+ * the functions, so a (start pc, shared) pair identifies a function.
+ */
+typedef std::pair<uint64_t, bool> FuncKey;
+typedef map<uint64_t, Function *> FuncMap;
+
+static bool
+isShared(Function *f)
+{
+    return std::strstr(f->getName().data(), BuildFunctions::SharedPrefix) != NULL;
 }
 
 static void
 gatherFuncsFromModule(Module *m,
-        map<uint64_t, Function *> &allFuncsMap,
+        FuncMap &allFuncsMap, FuncMap &sharedFuncsMap,
         list<Function *> &allFuncsList)
 {
+    PCIndex index;
+    index.rebuild(*m);
+
     for (auto funci = m->begin(), funce = m->end();
             funci != funce;
             ++funci) {
@@ -62,19 +98,19 @@ gatherFuncsFromModule(Module *m,
         if (!std::strstr(funci->getName().data(), "void-tcg-llvm-tb"))
             continue;
 
-        auto &bb = funci->getEntryBlock();
-        auto &ins = bb.front();
-        if (!ins.getMetadata("BB_pcStart")) {
+        const PCIndex::BlockInfo *info = index.getInfo(funci);
+        if (!info) {
             cout << "[linky] skip function (no BB_pcStart) " << funci->getName().data() << "\n";
             continue;
         }
 
-        uint64_t startPC = FixOverlappedBBs::getPCStartOfFunc(funci);
+        uint64_t startPC = info->pcStart;
+        FuncMap &funcs = isShared(funci) ? sharedFuncsMap : allFuncsMap;
 
         //cout << "[linky] doing func " << funci->getName().data() <<
         //endl;
-        if (allFuncsMap.find(startPC) == allFuncsMap.end()) {
-            allFuncsMap[startPC] = funci;
+        if (funcs.find(startPC) == funcs.end()) {
+            funcs[startPC] = funci;
             allFuncsList.push_back(funci);
             //cout << "[linky] new func at " << std::hex << startPC << "\n";
             //cout.unsetf(ios::hex);
@@ -85,54 +121,431 @@ gatherFuncsFromModule(Module *m,
     }
 }
 
-static void
-gatherFuncs(int fileCount, char *files[],
-        map<uint64_t, Function *> &allFuncsMap,
-        list<Function *> &allFuncsList)
-{
-    for (int i = 0; i < fileCount; ++i) {
-        SMDiagnostic error;
-        Module *m = ParseIRFile(std::string(files[i]), error,
-                getGlobalContext());
-        if (m) {
-            gatherFuncsFromModule(m, allFuncsMap, allFuncsList);
-        } else {
-            cout << "[linky] unable to load file " << files[i] << " " <<
-                endl;
-        }
-    }
-}
-
 static void
 cloneFuncs(Module *newModule,
-        list<Function *> &allFuncsList)
+        list<Function *> &allFuncsList,
+        const std::string &prefix = "linked-final-func-",
+        list<Function *> *cloned = NULL)
 {
     ValueToValueMapTy valueMap;
     /* clone all in the new module */
     for (auto funci = allFuncsList.begin(), funce = allFuncsList.end();
             funci != funce;
             ++funci) {
-        Constant *c = newModule->
-            getOrInsertFunction("linked-final-func-"+std::string((*funci)->getName()),
+        std::string name = prefix+std::string((*funci)->getName());
+        llvm::Function *newFunc = newModule->getFunction(name);
+        if (newFunc && !newFunc->isDeclaration()) {
+            /* a better version of a function linked before, the new one
+             * gets a unique name until it replaces the old one */
+            newFunc = Function::Create((*funci)->getFunctionType(),
+                    GlobalValue::ExternalLinkage, name, newModule);
+            newFunc->setAttributes((*funci)->getAttributes());
+        } else {
+            Constant *c = newModule->getOrInsertFunction(name,
                     (*funci)->getFunctionType(),
                     (*funci)->getAttributes());
-        llvm::Function *newFunc = cast<llvm::Function>(c);
+            newFunc = cast<llvm::Function>(c);
+        }
         assert(newFunc);
 
         SmallVector<llvm::ReturnInst *, 20> tempList;
         //cout << "[linky] clone function " << (*funci)->getName().data() << endl;
         BuildFunctions::copyGlobalReferences(newModule, *funci, valueMap);
         CloneFunctionInto(newFunc, *funci, valueMap, false, tempList);
+        if (cloned)
+            cloned->push_back(newFunc);
+    }
+}
+
+#ifndef NDEBUG
+/* true if v is, or uses through constants, a global of m */
+static bool
+usesModule(Value *v, Module *m)
+{
+    if (GlobalValue *g = dyn_cast<GlobalValue>(v))
+        return g->getParent() == m;
+    if (!isa<ConstantExpr>(v) && !isa<ConstantArray>(v) &&
+            !isa<ConstantStruct>(v) && !isa<ConstantVector>(v))
+        return false;
+    User *u = cast<User>(v);
+    for (auto opi = u->op_begin(), ope = u->op_end(); opi != ope; ++opi)
+        if (usesModule(*opi, m))
+            return true;
+    return false;
+}
+
+static bool
+usesModule(Function *f, Module *m)
+{
+    for (auto bbi = f->begin(), bbe = f->end(); bbi != bbe; ++bbi)
+        for (auto insi = bbi->begin(), inse = bbi->end(); insi != inse; ++insi)
+            for (auto opi = insi->op_begin(), ope = insi->op_end();
+                    opi != ope;
+                    ++opi)
+                if (usesModule(*opi, m))
+                    return true;
+    return false;
+}
+#endif
+
+static Module *
+loadModule(const char *path, LLVMContext &ctx)
+{
+    OwningPtr<MemoryBuffer> buffer;
+    std::string error;
+
+    if (!MemoryBuffer::getFile(path, buffer)) {
+        /* the module owns the buffer from now on */
+        Module *m = getLazyBitcodeModule(buffer.get(), ctx, &error);
+        if (m) {
+            buffer.take();
+            return m;
+        }
+    }
+
+    /* not bitcode (or unreadable), parse it the old way */
+    SMDiagnostic diag;
+    return ParseIRFile(std::string(path), diag, ctx);
+}
+
+struct Candidate {
+    uint64_t pc;
+    uint64_t score;
+    bool shared;
+    Function *func;
+
+    FuncKey key() const { return FuncKey(pc, shared); }
+};
+typedef vector<Candidate> Candidates;
+
+/*
+ * List the (start pc, score, function) tuples of a lazily loaded module.
+ * The table written by BuildFunctions gives them without materializing
+ * anything (tables without a score rank every candidate the same, tables
+ * without the shared flag tell the shared functions by name).
+ * Inputs without the table are materialized and scored as a whole.
+ */
+static bool
+listCandidates(Module *m, Candidates &candidates, std::string &error)
+{
+    NamedMDNode *table = m->getNamedMetadata(BuildFunctions::FuncsMetadata);
+
+    if (table) {
+        for (unsigned i = 0, e = table->getNumOperands(); i != e; ++i) {
+            MDNode *md = table->getOperand(i);
+            Function *f = md->getNumOperands() > 1 ?
+                dyn_cast_or_null<Function>(md->getOperand(0)) : NULL;
+            MDString *pc = md->getNumOperands() > 1 ?
+                dyn_cast_or_null<MDString>(md->getOperand(1)) : NULL;
+            ConstantInt *score = md->getNumOperands() > 2 ?
+                dyn_cast_or_null<ConstantInt>(md->getOperand(2)) : NULL;
+            ConstantInt *shared = md->getNumOperands() > 3 ?
+                dyn_cast_or_null<ConstantInt>(md->getOperand(3)) : NULL;
+            if (!f || !pc)
+                continue;
+
+            Candidate c;
+            c.pc = strtoull(pc->getString().str().c_str(), NULL, 16);
+            c.score = score ? score->getZExtValue() : 0;
+            c.shared = shared ? !shared->isZero() : isShared(f);
+            c.func = f;
+            candidates.push_back(c);
+        }
+        return true;
+    }
+
+    if (m->MaterializeAll(&error))
+        return false;
+
+    PCIndex index;
+    index.rebuild(*m);
+    for (auto funci = m->begin(), funce = m->end();
+            funci != funce;
+            ++funci) {
+        const PCIndex::BlockInfo *info = index.getInfo(funci);
+        if (!info)
+            continue;
+        Candidate c;
+        c.pc = info->pcStart;
+        c.score = BuildFunctions::getCoverageScore(funci);
+        c.shared = isShared(funci);
+        c.func = funci;
+        candidates.push_back(c);
+    }
+    return true;
+}
+
+static bool
+materialize(Function *f, std::string &error)
+{
+    return !(f->isMaterializable() && f->Materialize(&error));
+}
+
+/* (input, position in the input) of a candidate */
+typedef std::pair<unsigned, unsigned> InputPos;
+
+/*
+ * The selected candidate of every FuncKey: the highest score wins, on
+ * a tie the first one in input order. Functions already linked (in
+ * incremental mode) are only replaced by a strictly better candidate.
+ */
+struct Selection {
+    uint64_t score;
+    InputPos pos;
+};
+typedef map<FuncKey, Selection> SelectionMap;
+typedef map<FuncKey, uint64_t> KnownScores;
+
+static void
+offerCandidates(SelectionMap &best, const KnownScores &known,
+        unsigned input, const Candidates &candidates)
+{
+    for (unsigned pos = 0; pos < candidates.size(); ++pos) {
+        const Candidate &c = candidates[pos];
+        auto linked = known.find(c.key());
+        if (linked != known.end() && linked->second >= c.score)
+            continue;
+
+        Selection here = {c.score, InputPos(input, pos)};
+        auto sel = best.find(c.key());
+        if (sel == best.end())
+            best[c.key()] = here;
+        else if (c.score > sel->second.score ||
+                (c.score == sel->second.score && here.pos < sel->second.pos))
+            sel->second = here;
+    }
+}
+
+static bool
+isSelected(const SelectionMap &best, const Candidate &c, InputPos pos)
+{
+    auto sel = best.find(c.key());
+    return sel != best.end() && sel->second.pos == pos;
+}
+
+/* materialize the selected functions of input */
+static void
+pickSelected(const SelectionMap &best, unsigned input,
+        const Candidates &candidates, list<Function *> &picked,
+        std::string &log)
+{
+    std::string error;
+
+    for (unsigned pos = 0; pos < candidates.size(); ++pos) {
+        if (!isSelected(best, candidates[pos], InputPos(input, pos)))
+            continue;
+        Function *f = candidates[pos].func;
+        if (!materialize(f, error)) {
+            log += "[linky] unable to materialize " +
+                std::string(f->getName()) + ": " + error + "\n";
+            continue;
+        }
+        picked.push_back(f);
+    }
+}
+
+/*
+ * The input modules are loaded one at a time: a first pass over the
+ * function tables selects the best candidate of every start PC, a second
+ * one clones the selected functions. A module is dropped once it is
+ * scanned (or its functions are cloned), so memory scales with the
+ * unique functions.
+ */
+static unsigned
+gatherFuncs(int fileCount, char *files[], Module *newModule,
+        const KnownScores &known, list<Function *> &cloned)
+{
+    SelectionMap best;
+    vector<bool> hasSelected(fileCount, false);
+    unsigned cnt = 0;
+
+    for (int i = 0; i < fileCount; ++i) {
+        Module *m = loadModule(files[i], getGlobalContext());
+        if (!m) {
+            cout << "[linky] unable to load file " << files[i] << " " <<
+                endl;
+            continue;
+        }
+
+        std::string error;
+        Candidates candidates;
+        if (listCandidates(m, candidates, error))
+            offerCandidates(best, known, i, candidates);
+        else
+            cout << "[linky] unable to materialize module: " << error << endl;
+        delete m;
+    }
+
+    for (auto si = best.begin(), se = best.end(); si != se; ++si)
+        hasSelected[si->second.pos.first] = true;
+
+    for (int i = 0; i < fileCount; ++i) {
+        if (!hasSelected[i])
+            continue;
+        Module *m = loadModule(files[i], getGlobalContext());
+        if (!m)
+            continue;
+
+        std::string error, log;
+        Candidates candidates;
+        list<Function *> picked;
+        if (listCandidates(m, candidates, error))
+            pickSelected(best, i, candidates, picked, log);
+        cout << log;
+        cloneFuncs(newModule, picked, "linked-final-func-", &cloned);
+        cnt += picked.size();
+        /* the clones only use globals declared in newModule, including
+         * the ones under constant expressions, so m can go */
+        delete m;
     }
     cout << "[linky] done cloning\n";
+    return cnt;
 }
 
+/*
+ * Parallel version of gatherFuncs. Every input gets its own context and
+ * is handled by one thread at a time:
+ *  1. load it lazily and offer its candidates to the shared selection;
+ *  2. materialize the selected functions, clone them into a module of
+ *     the input's context and serialize it;
+ *  3. the main thread parses the serialized modules in input order and
+ *     clones them into the final module,
+ * so the output is the same as with a single thread.
+ */
+struct InputFile {
+    const char *path;
+    LLVMContext *ctx;
+    Module *module;
+    Candidates candidates;
+    vector<std::string> picked;
+    std::string bitcode;
+    std::string log;
+};
+
+static void
+runOnInputs(vector<InputFile> &inputs, unsigned threads,
+        std::function<void (unsigned)> work)
+{
+    std::atomic<unsigned> next(0);
+    vector<std::thread> pool;
+
+    for (unsigned t = 0; t < threads; ++t) {
+        pool.push_back(std::thread([&]() {
+            for (unsigned i = next++; i < inputs.size(); i = next++)
+                work(i);
+        }));
+    }
+    for (auto ti = pool.begin(), te = pool.end(); ti != te; ++ti)
+        ti->join();
+}
+
+static unsigned
+gatherFuncsParallel(int fileCount, char *files[], Module *newModule,
+        unsigned threads, const KnownScores &known,
+        list<Function *> &cloned)
+{
+    vector<InputFile> inputs(fileCount);
+    SelectionMap best;
+    std::mutex bestLock;
+    unsigned cnt = 0;
+
+    if (!llvm_is_multithreaded())
+        llvm_start_multithreaded();
+
+    runOnInputs(inputs, threads, [&](unsigned i) {
+        InputFile &in = inputs[i];
+        in.path = files[i];
+        in.ctx = new LLVMContext();
+        in.module = loadModule(in.path, *in.ctx);
+        if (!in.module) {
+            in.log = "[linky] unable to load file " + std::string(in.path) + "\n";
+            return;
+        }
+        std::string error;
+        if (!listCandidates(in.module, in.candidates, error)) {
+            in.log = "[linky] unable to materialize module: " + error + "\n";
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(bestLock);
+        offerCandidates(best, known, i, in.candidates);
+    });
+
+    runOnInputs(inputs, threads, [&](unsigned i) {
+        InputFile &in = inputs[i];
+        list<Function *> picked;
+
+        /* the selection is read only by now */
+        if (in.module)
+            pickSelected(best, i, in.candidates, picked, in.log);
+        for (auto fi = picked.begin(), fe = picked.end(); fi != fe; ++fi)
+            in.picked.push_back((*fi)->getName());
+
+        if (!picked.empty()) {
+            Module *out = new Module("Picked", *in.ctx);
+            cloneFuncs(out, picked, "");
+            raw_string_ostream os(in.bitcode);
+            WriteBitcodeToFile(out, os);
+            os.flush();
+            delete out;
+        }
+
+        delete in.module;
+        in.module = NULL;
+        delete in.ctx;
+        in.ctx = NULL;
+    });
+
+    for (auto ini = inputs.begin(), ine = inputs.end(); ini != ine; ++ini) {
+        cout << ini->log;
+        if (ini->bitcode.empty())
+            continue;
+
+        std::string error;
+        MemoryBuffer *buffer = MemoryBuffer::getMemBuffer(ini->bitcode, "",
+                false);
+        Module *m = ParseBitcodeFile(buffer, getGlobalContext(), &error);
+        delete buffer;
+        if (!m) {
+            cout << "[linky] unable to parse the functions of " <<
+                ini->path << ": " << error << endl;
+            continue;
+        }
+
+        list<Function *> picked;
+        for (auto ni = ini->picked.begin(), ne = ini->picked.end();
+                ni != ne;
+                ++ni) {
+            Function *f = m->getFunction(*ni);
+            assert(f && !f->isDeclaration());
+            picked.push_back(f);
+        }
+        list<Function *> clones;
+        cloneFuncs(newModule, picked, "linked-final-func-", &clones);
+        cnt += picked.size();
+        /* the picked module is dropped: nothing cloned may still point
+         * in it, not even through a constant expression */
+        for (auto fi = clones.begin(), fe = clones.end(); fi != fe; ++fi)
+            assert(!usesModule(*fi, m));
+        cloned.splice(cloned.end(), clones);
+        delete m;
+    }
+    cout << "[linky] done cloning\n";
+    return cnt;
+}
+
+/* call target (or shared tail) that is not linked yet -> the functions
+ * calling it */
+typedef map<FuncKey, set<std::string> > PendingCalls;
+
 static void
 linkFuncs(Module *newModule,
-        map<uint64_t, Function *> &allFuncsMap,
-        list<Function *> &allFuncsList)
+        FuncMap &allFuncsMap, FuncMap &sharedFuncsMap,
+        list<Function *> &allFuncsList,
+        PendingCalls *pending = NULL)
 {
     list<std::pair<StoreInst *, Function *> > directCalls;
+    unsigned sharedTails = 0;
 
     /* gather direct calls */
     for (auto funci = allFuncsList.begin(), funce = allFuncsList.end();
@@ -151,6 +564,26 @@ linkFuncs(Module *newModule,
             for (auto insi = bbi->begin(), inse = bbi->end();
                     insi != inse;
                     ++insi) {
+                CallInst *callInst = dyn_cast<CallInst>(insi);
+                if (callInst && callInst->getMetadata("INS_sharedTail")) {
+                    /* the stub still calls the declaration of the shared
+                     * function it was built with
+                     */
+                    uint64_t targetPC =
+                        FixOverlappedBBs::getHexMetadataFromIns(insi,
+                                "INS_sharedTail");
+                    if (sharedFuncsMap.find(targetPC) == sharedFuncsMap.end()) {
+                        cout << "[linky] unknown shared tail " <<
+                            FixOverlappedBBs::hex(targetPC) << endl;
+                        if (pending)
+                            (*pending)[FuncKey(targetPC, true)].insert(
+                                    (*funci)->getName());
+                        continue;
+                    }
+                    callInst->setCalledFunction(sharedFuncsMap[targetPC]);
+                    ++sharedTails;
+                    continue;
+                }
                 if (isa<StoreInst>(insi)) {
                     StoreInst *storeInst = dyn_cast<StoreInst>(insi);
                     if (storeInst->getMetadata("INS_directCall")) {
@@ -160,6 +593,9 @@ linkFuncs(Module *newModule,
                         if (allFuncsMap.find(targetPC) == allFuncsMap.end()) {
                             cout << "[linky] unknown call to " <<
                                 FixOverlappedBBs::hex(targetPC) << endl;
+                            if (pending)
+                                (*pending)[FuncKey(targetPC, false)].insert(
+                                        (*funci)->getName());
                             continue;
                         }
                         assert(allFuncsMap.find(targetPC) != allFuncsMap.end());
@@ -172,7 +608,8 @@ linkFuncs(Module *newModule,
     }
 
     cout.unsetf(ios::hex);
-    cout << "[linky] we got " << directCalls.size() << " direct calls" << endl;
+    cout << "[linky] we got " << directCalls.size() << " direct calls and " <<
+        sharedTails << " shared tails" << endl;
 
     /* perform the actual linking */
     for (auto calli = directCalls.begin(), calle = directCalls.end();
@@ -188,54 +625,246 @@ linkFuncs(Module *newModule,
 
         ReplaceInstWithInst(storeInst, c);
     }
+
+    /* the shared functions are only reached through tail calls */
+    list<Function *> unusedDecls;
+    for (auto funci = newModule->begin(), funce = newModule->end();
+            funci != funce;
+            ++funci) {
+        if (!std::strstr(funci->getName().data(),
+                    BuildFunctions::SharedPrefix))
+            continue;
+        if (funci->isDeclaration()) {
+            if (funci->use_empty())
+                unusedDecls.push_back(funci);
+        } else {
+            funci->setLinkage(GlobalValue::InternalLinkage);
+        }
+    }
+    for (auto funci = unusedDecls.begin(), funce = unusedDecls.end();
+            funci != funce;
+            ++funci) {
+        (*funci)->eraseFromParent();
+    }
     cout << "[linky] done linking\n";
 }
 
+/* one "pc name score" line per linked function, shared ones included */
+static void
+readIndex(const std::string &path, Module *m,
+        FuncMap &allFuncsMap, FuncMap &sharedFuncsMap, KnownScores &scores)
+{
+    std::ifstream in(path.c_str());
+    std::string pc, name;
+    uint64_t score;
+
+    while (in >> pc >> name >> score) {
+        Function *f = m->getFunction(name);
+        if (!f) {
+            cout << "[linky] index names a missing function " << name << endl;
+            continue;
+        }
+        uint64_t startPC = strtoull(pc.c_str(), NULL, 16);
+        bool shared = isShared(f);
+        (shared ? sharedFuncsMap : allFuncsMap)[startPC] = f;
+        scores[FuncKey(startPC, shared)] = score;
+    }
+}
+
+static void
+writeIndex(const std::string &path, FuncMap &allFuncsMap,
+        FuncMap &sharedFuncsMap, KnownScores &scores)
+{
+    std::ofstream out(path.c_str());
+
+    for (auto fi = allFuncsMap.begin(), fe = allFuncsMap.end(); fi != fe; ++fi)
+        out << FixOverlappedBBs::hex(fi->first) << " " <<
+            fi->second->getName().str() << " " <<
+            scores[FuncKey(fi->first, false)] << "\n";
+    for (auto fi = sharedFuncsMap.begin(), fe = sharedFuncsMap.end();
+            fi != fe;
+            ++fi)
+        out << FixOverlappedBBs::hex(fi->first) << " " <<
+            fi->second->getName().str() << " " <<
+            scores[FuncKey(fi->first, true)] << "\n";
+}
+
+/* one "call|tail pc name" line per unresolved call or shared tail */
+static void
+readPending(const std::string &path, PendingCalls &pending)
+{
+    std::ifstream in(path.c_str());
+    std::string kind, pc, name;
+
+    while (in >> kind >> pc >> name)
+        pending[FuncKey(strtoull(pc.c_str(), NULL, 16), kind == "tail")].
+            insert(name);
+}
+
+static void
+writePending(const std::string &path, PendingCalls &pending)
+{
+    std::ofstream out(path.c_str());
+
+    for (auto pi = pending.begin(), pe = pending.end(); pi != pe; ++pi) {
+        for (auto ni = pi->second.begin(), ne = pi->second.end(); ni != ne; ++ni)
+            out << (pi->first.second ? "tail " : "call ") <<
+                FixOverlappedBBs::hex(pi->first.first) << " " << *ni << "\n";
+    }
+}
+
 int
 main(int argc, char *argv[])
 {
-    if (argc < 3) {
+    unsigned threads = 1;
+    bool incremental = false;
+    int first = 1;
+
+    while (first < argc && argv[first][0] == '-') {
+        std::string flag(argv[first]);
+        if (flag == "-j" && first + 1 < argc) {
+            threads = std::max(1, atoi(argv[first+1]));
+            first += 2;
+        } else if (flag == "--incremental") {
+            incremental = true;
+            first += 1;
+        } else {
+            usage(argv[0]);
+            exit(-1);
+        }
+    }
+
+    if (argc - first < 2) {
         usage(argv[0]);
         exit(-1);
     }
 
-    map<uint64_t, Function *> allFuncsMap;
+    FuncMap allFuncsMap, sharedFuncsMap;
     list<Function *> allFuncsList;
+    PendingCalls pending;
+    KnownScores scores;
+    std::string outPath(argv[argc-1]);
 
     cout << "[linky] linking: ";
-    for (unsigned i = 1; i < argc-1; ++i) {
+    for (int i = first; i < argc-1; ++i) {
         cout << argv[i] << "\n";
     }
-    cout << "into " << argv[argc-1] << "\n";
-    gatherFuncs(argc-2, argv+1, allFuncsMap, allFuncsList);
-    cout.unsetf(ios::hex);
-    cout << "[linky] discovered " << allFuncsList.size() << " unique functions" << endl;
+    cout << "into " << outPath << "\n";
 
-    Module *newModule = new llvm::Module("LinkedFunctions",
-            llvm::getGlobalContext());
+    /* in incremental mode the output is also the input: the linked
+     * module, its pc -> function index and the calls still unresolved */
+    Module *newModule = NULL;
+    if (incremental && std::ifstream(outPath.c_str()).good()) {
+        SMDiagnostic diag;
+        newModule = ParseIRFile(outPath, diag, getGlobalContext());
+        if (!newModule) {
+            cout << "[linky] unable to load " << outPath << endl;
+            exit(-1);
+        }
+        readIndex(outPath + ".index", newModule, allFuncsMap, sharedFuncsMap,
+                scores);
+        if (allFuncsMap.empty()) {
+            gatherFuncsFromModule(newModule, allFuncsMap, sharedFuncsMap,
+                    allFuncsList);
+            for (auto fi = allFuncsMap.begin(), fe = allFuncsMap.end();
+                    fi != fe;
+                    ++fi)
+                scores[FuncKey(fi->first, false)] =
+                    BuildFunctions::getCoverageScore(fi->second);
+            for (auto fi = sharedFuncsMap.begin(), fe = sharedFuncsMap.end();
+                    fi != fe;
+                    ++fi)
+                scores[FuncKey(fi->first, true)] =
+                    BuildFunctions::getCoverageScore(fi->second);
+        }
+        readPending(outPath + ".pending", pending);
+        cout << "[linky] resuming with " << allFuncsMap.size() <<
+            " functions and " << pending.size() << " pending targets" << endl;
+    } else {
+        newModule = new llvm::Module("LinkedFunctions",
+                llvm::getGlobalContext());
+    }
     assert(newModule);
-    cloneFuncs(newModule, allFuncsList);
 
-    allFuncsMap.clear();
-    allFuncsList.clear();
-    gatherFuncsFromModule(newModule, allFuncsMap, allFuncsList);
-    linkFuncs(newModule, allFuncsMap, allFuncsList);
+    list<Function *> cloned;
+    unsigned unique = threads > 1 ?
+        gatherFuncsParallel(argc-first-1, argv+first, newModule, threads,
+                scores, cloned) :
+        gatherFuncs(argc-first-1, argv+first, newModule, scores, cloned);
+    cout.unsetf(ios::hex);
+    cout << "[linky] discovered " << unique << " unique functions" << endl;
+
+    /* only the new functions, and the old ones calling them, are linked */
+    PCIndex index;
+    list<Function *> toLink;
+    for (auto funci = cloned.begin(), funce = cloned.end();
+            funci != funce;
+            ++funci) {
+        if (!index.insert(*funci)) {
+            cout << "[linky] skip function (no BB_pcStart) " <<
+                (*funci)->getName().data() << "\n";
+            continue;
+        }
+        uint64_t startPC = index.getPCStart(*funci);
+        bool shared = isShared(*funci);
+        FuncMap &funcs = shared ? sharedFuncsMap : allFuncsMap;
+        auto linked = funcs.find(startPC);
+        if (linked != funcs.end() && linked->second != *funci) {
+            /* a better candidate for a function linked before, the
+             * calls to the old version now go to the new one */
+            Function *old = linked->second;
+            cout << "[linky] replace " << old->getName().data() << endl;
+            old->replaceAllUsesWith(*funci);
+            (*funci)->takeName(old);
+            old->eraseFromParent();
+        }
+        funcs[startPC] = *funci;
+        scores[FuncKey(startPC, shared)] =
+            BuildFunctions::getCoverageScore(*funci);
+        toLink.push_back(*funci);
+    }
+
+    set<std::string> revisit;
+    for (auto pi = pending.begin(); pi != pending.end();) {
+        FuncMap &funcs = pi->first.second ? sharedFuncsMap : allFuncsMap;
+        if (funcs.find(pi->first.first) == funcs.end()) {
+            ++pi;
+            continue;
+        }
+        revisit.insert(pi->second.begin(), pi->second.end());
+        pending.erase(pi++);
+    }
+    for (auto ni = revisit.begin(), ne = revisit.end(); ni != ne; ++ni) {
+        if (Function *f = newModule->getFunction(*ni))
+            toLink.push_back(f);
+    }
+
+    linkFuncs(newModule, allFuncsMap, sharedFuncsMap, toLink,
+            incremental ? &pending : NULL);
 
-    cout << "[linky] saving " << allFuncsList.size() << " functions to " <<
-        argv[argc-1] << "\n";
+    cout << "[linky] saving " << allFuncsMap.size() << " functions to " <<
+        outPath << "\n";
 
     std::string error;
     llvm::raw_fd_ostream bitcodeOstream(
-            argv[argc-1],
+            outPath.c_str(),
             error, 0);
     llvm::WriteBitcodeToFile(newModule,
             bitcodeOstream);
     bitcodeOstream.close();
 
+    if (!AddressMap::write(*newModule, outPath + ".addrmap"))
+        cout << "[linky] unable to write " << outPath << ".addrmap" << endl;
+
+    if (incremental) {
+        writeIndex(outPath + ".index", allFuncsMap, sharedFuncsMap, scores);
+        writePending(outPath + ".pending", pending);
+    }
+
     llvm::raw_fd_ostream functionCnt(
-            (std::string(argv[argc-1])+std::string(".fcnt")).c_str(),
+            (outPath+std::string(".fcnt")).c_str(),
         error, 0);
-    functionCnt << allFuncsList.size();
+    functionCnt << allFuncsMap.size();
     functionCnt.close();
     return 0;
 }
@@ -0,0 +1,186 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * pipey runs the per-iteration pass chain of bin2llvm.py in one process:
+ *
+ *   pre:       -mem2reg ... -buildfunctions (run_passes_pre)
+ *   solver:    -solveindirectsingle -dce on the functions and on the
+ *              remaining blocks (run_indirect_solver, twice)
+ *   thumb:     -armdumpthumbbit on the solved functions
+ *              (run_arm_dump_thumb_bit)
+ *
+ * translated_bbs.bc is parsed once and every stage works on the modules
+ * in memory. Only the files the driver reads are written: the functions
+ * (-save-funcs), the solved functions, the two target lists and the
+ * thumb bits. The options of the translator passes (-memory,
+ * -jump-table-info, -outline-shared-bbs, ...) are accepted as with opt.
+ */
+
+#include <llvm/InitializePasses.h>
+#include <llvm/LLVMContext.h>
+#include <llvm/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/PassManager.h>
+#include <llvm/PassRegistry.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/IRReader.h>
+#include <llvm/Support/ManagedStatic.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdlib>
+#include <string>
+
+#include "../translator/ARMDumpThumbBit.h"
+#include "../translator/BuildFunctions.h"
+#include "../translator/SolveIndirectSingle.h"
+
+using namespace llvm;
+
+static cl::opt<std::string> InputFilename(cl::Positional,
+        cl::desc("<translated_bbs.bc>"), cl::Required);
+
+static cl::opt<std::string> FuncsIndirectOut("funcs-indirect-out",
+        cl::desc("Save the functions with solved indirect stores here"),
+        cl::value_desc("filename"), cl::Required);
+
+static cl::opt<std::string> FuncsTargets("funcs-targets",
+        cl::desc("New targets found in the functions"),
+        cl::value_desc("filename"), cl::Required);
+
+static cl::opt<std::string> RemainingTargets("remaining-targets",
+        cl::desc("New targets found in the remaining blocks"),
+        cl::value_desc("filename"), cl::Required);
+
+static cl::opt<std::string> ThumbOut("thumb-out",
+        cl::desc("Thumb bits of the solved functions"),
+        cl::value_desc("filename"), cl::Required);
+
+static cl::opt<std::string> RemainingOut("remaining-out",
+        cl::desc("Also save the remaining blocks (debug only)"),
+        cl::value_desc("filename"), cl::init(""));
+
+/* the pre stage, the pass arguments are the ones given to opt */
+static const char *PrePasses[] = {
+    "mem2reg",
+    "transfrombbtovoid",
+    "track-inst-pc",
+    "fixoverlappedbbs",
+    "dce",
+    "internalize-globals",
+    "replaceconstantloads",
+    "dce",
+    "gvn",
+    "dce",
+    "armclassifycf",
+    "rmbranchtrace",
+};
+
+static bool
+addPass(PassManager &pm, const char *arg)
+{
+    const PassInfo *info = PassRegistry::getPassRegistry()->getPassInfo(arg);
+    if (!info || !info->getNormalCtor()) {
+        errs() << "[pipey] unknown pass " << arg << "\n";
+        return false;
+    }
+    pm.add(info->createPass());
+    return true;
+}
+
+static bool
+writeModule(Module *m, const std::string &path)
+{
+    std::string error;
+    raw_fd_ostream os(path.c_str(), error, raw_fd_ostream::F_Binary);
+    if (!error.empty()) {
+        errs() << "[pipey] unable to write " << path << ": " << error << "\n";
+        return false;
+    }
+    WriteBitcodeToFile(m, os);
+    return true;
+}
+
+/* the targets are saved when the pass manager deletes the solver */
+static void
+solveIndirect(Module *m, const std::string &solvedFile)
+{
+    PassManager pm;
+    pm.add(new SolveIndirectSingle(solvedFile));
+    addPass(pm, "dce");
+    pm.run(*m);
+}
+
+int
+main(int argc, char *argv[])
+{
+    llvm_shutdown_obj shutdown;
+    PassRegistry &registry = *PassRegistry::getPassRegistry();
+    initializeCore(registry);
+    initializeScalarOpts(registry);
+    initializeAnalysis(registry);
+    initializeIPA(registry);
+    initializeTransformUtils(registry);
+
+    cl::ParseCommandLineOptions(argc, argv, "bin2llvm iteration pipeline\n");
+
+    SMDiagnostic diag;
+    Module *module = ParseIRFile(InputFilename, diag, getGlobalContext());
+    if (!module) {
+        diag.print(argv[0], errs());
+        return 1;
+    }
+
+    /* pre: module keeps the blocks no function took */
+    Module *funcs = NULL;
+    {
+        PassManager pm;
+        for (unsigned i = 0; i < sizeof(PrePasses) / sizeof(PrePasses[0]); ++i)
+            if (!addPass(pm, PrePasses[i]))
+                return 1;
+        /* owned by pm, take the functions before it goes away */
+        BuildFunctions *builder = new BuildFunctions();
+        pm.add(builder);
+        pm.run(*module);
+        funcs = builder->takeFunctionsModule();
+    }
+    if (!funcs) {
+        errs() << "[pipey] no functions were built\n";
+        return 1;
+    }
+
+    solveIndirect(funcs, FuncsTargets);
+    if (!writeModule(funcs, FuncsIndirectOut))
+        return 1;
+
+    solveIndirect(module, RemainingTargets);
+    if (!RemainingOut.empty() && !writeModule(module, RemainingOut))
+        return 1;
+
+    {
+        PassManager pm;
+        pm.add(new ARMDumpThumbBit(ThumbOut));
+        pm.run(*funcs);
+    }
+
+    delete funcs;
+    delete module;
+    return 0;
+}
@@ -0,0 +1,196 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ARMControlFlowClassifier.h"
+#include "FixOverlappedBBs.h"
+#include "PCIndex.h"
+
+#include <llvm/Instructions.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <string>
+
+using namespace llvm;
+
+char ARMControlFlowClassifier::ID = 0;
+static RegisterPass<ARMControlFlowClassifier> X("armclassifycf",
+        "Mark calls, returns, jumps and function entries on ARM", false, false);
+
+void
+ARMControlFlowClassifier::getAnalysisUsage(AnalysisUsage &AU) const
+{
+    AU.addRequired<PCIndex>();
+    AU.addPreserved<PCIndex>();
+}
+
+MDNode *
+ARMControlFlowClassifier::getHexNode(LLVMContext &ctx, uint64_t value)
+{
+    MDNode *&md = m_hexNodes[value];
+    if (!md)
+        md = MDNode::get(ctx, MDString::get(ctx, FixOverlappedBBs::hex(value)));
+    return md;
+}
+
+/* same patterns as ARMMarkReturn::usesLR: LR & cst, or the value popped
+ * into LR (pop {lr}; bx lr) */
+bool
+ARMControlFlowClassifier::usesLR(Value *val)
+{
+    BinaryOperator *storeToPcOp = dyn_cast<BinaryOperator>(val);
+    if (!storeToPcOp || storeToPcOp->getOpcode() != Instruction::And)
+        return false;
+
+    LoadInst *load = dyn_cast<LoadInst>(storeToPcOp->getOperand(0));
+    if (load && isa<ConstantInt>(storeToPcOp->getOperand(1)))
+        return load->getPointerOperand() == m_LR;
+
+    Value *ins = storeToPcOp->getOperand(0);
+    if (!isa<CallInst>(ins))
+        return false;
+    for (auto ui = ins->use_begin(), uie = ins->use_end();
+            ui != uie;
+            ++ui) {
+        StoreInst *store = dyn_cast<StoreInst>(*ui);
+        if (store && store->getPointerOperand() == m_LR)
+            return true;
+    }
+    return false;
+}
+
+bool
+ARMControlFlowClassifier::classifyFunction(Function &F, uint64_t pcEnd,
+        std::set<uint64_t> &directCallTargets)
+{
+    LLVMContext &ctx = F.getContext();
+    bool modified = false;
+
+    for (auto bbi = F.begin(), bbie = F.end();
+            bbi != bbie;
+            ++bbi) {
+        bool hasLRStore = false;
+        bool isReturnBB = false;
+        uint64_t lrVal = 0;
+
+        for (auto insi = bbi->begin(), insie = bbi->end();
+                insi != insie;
+                ++insi) {
+            StoreInst *storeInst = dyn_cast<StoreInst>(insi);
+            if (!storeInst)
+                continue;
+            Value *ptr = storeInst->getPointerOperand();
+            ConstantInt *val = dyn_cast<ConstantInt>(storeInst->getValueOperand());
+
+            if (ptr == m_LR) {
+                if (val) {
+                    lrVal = val->getZExtValue();
+                    hasLRStore = true;
+                }
+                continue;
+            }
+            if (ptr != m_PC)
+                continue;
+
+            /* call: LR was set to the end of this block */
+            if (hasLRStore && (pcEnd == lrVal || pcEnd == lrVal-1)) {
+                if (val) {
+                    uint64_t target = val->getZExtValue();
+                    storeInst->setMetadata("INS_directCall", getHexNode(ctx, target));
+                    if (bbi == F.begin())
+                        directCallTargets.insert(target);
+                } else {
+                    storeInst->setMetadata("INS_indirectCall",
+                            getHexNode(ctx, 0xdeadbeef));
+                }
+                storeInst->setMetadata("INS_callReturn",
+                        getHexNode(ctx, lrVal & -2));
+                ++m_calls;
+            } else if (!val && usesLR(storeInst->getValueOperand())) {
+                storeInst->setMetadata("INS_return", m_trueNode);
+                isReturnBB = true;
+                ++m_returns;
+            } else if (val) {
+                storeInst->setMetadata("INS_directJump",
+                        getHexNode(ctx, val->getZExtValue()));
+                ++m_jumps;
+            } else {
+                storeInst->setMetadata("INS_indirectJump",
+                        getHexNode(ctx, 0xdeadbeef));
+                if (storeInst->getMetadata("INS_switch_cnt"))
+                    ++m_switches;
+                else
+                    ++m_indirectJumps;
+            }
+            modified = true;
+        }
+
+        if (isReturnBB)
+            bbi->setName("func_return_bb_"+std::string(bbi->getName()));
+    }
+
+    return modified;
+}
+
+bool
+ARMControlFlowClassifier::runOnModule(Module &M)
+{
+    PCIndex &index = getAnalysis<PCIndex>();
+    std::set<uint64_t> directCallTargets;
+    unsigned entries = 0;
+    bool modified = false;
+
+    m_PC = M.getNamedGlobal("PC");
+    m_LR = M.getNamedGlobal("LR");
+    if (!m_PC)
+        return false;
+
+    m_hexNodes.clear();
+    m_trueNode = MDNode::get(M.getContext(),
+            MDString::get(M.getContext(), std::string("true")));
+    m_calls = m_returns = m_jumps = m_indirectJumps = m_switches = 0;
+
+    for (auto funci = M.begin(), funcie = M.end();
+            funci != funcie;
+            ++funci) {
+        const PCIndex::BlockInfo *info = index.getInfo(funci);
+        if (!info)
+            continue;
+        modified |= classifyFunction(*funci, info->pcEnd, directCallTargets);
+    }
+
+    for (auto ti = directCallTargets.begin(), tie = directCallTargets.end();
+            ti != tie;
+            ++ti) {
+        PCIndex::StartRange blocks = index.lookupAll(*ti);
+        for (auto bi = blocks.first; bi != blocks.second; ++bi) {
+            Function *func = bi->second;
+            func->front().setName("func_entry_point");
+            index.setEntry(func, true);
+            ++entries;
+            modified = true;
+        }
+    }
+
+    outs() << "[ARMControlFlowClassifier] calls: " << m_calls <<
+        " returns: " << m_returns << " jumps: " << m_jumps <<
+        " indirect jumps: " << m_indirectJumps << " switches: " <<
+        m_switches << " entries: " << entries << "\n";
+
+    return modified;
+}
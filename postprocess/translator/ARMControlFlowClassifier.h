@@ -0,0 +1,70 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ARMCONTROLFLOWCLASSIFIER_H__
+#define __ARMCONTROLFLOWCLASSIFIER_H__ 1
+
+#include <llvm/Pass.h>
+#include <llvm/Function.h>
+#include <llvm/Module.h>
+#include <llvm/Metadata.h>
+#include <llvm/Constants.h>
+#include <llvm/ADT/DenseMap.h>
+
+#include <set>
+#include <cstdint>
+
+/*
+ * This pass does the work of -armmarkcall, -armmarkreturn,
+ * -armmarkjumps and -markfuncentry in a single sweep over the blocks in
+ * the PCIndex. Every store to PC is classified as a direct/indirect
+ * call, a return or a direct/indirect jump (switches are the indirect
+ * jumps already annotated by -replaceconstantloads), with the same
+ * metadata the separate passes set. The entry blocks of direct call
+ * targets are then renamed to func_entry_point.
+ *
+ * Returns are recognised on the loads of LR, so run it after -gvn.
+ */
+struct ARMControlFlowClassifier: public llvm::ModulePass {
+    static char ID;
+
+    ARMControlFlowClassifier() : llvm::ModulePass(ID) {}
+
+    virtual bool runOnModule(llvm::Module &M);
+    virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
+private:
+    llvm::GlobalVariable *m_PC;
+    llvm::GlobalVariable *m_LR;
+
+    /* uniqued hex metadata, one node per value */
+    llvm::DenseMap<uint64_t, llvm::MDNode *> m_hexNodes;
+    llvm::MDNode *m_trueNode;
+
+    unsigned m_calls;
+    unsigned m_returns;
+    unsigned m_jumps;
+    unsigned m_indirectJumps;
+    unsigned m_switches;
+
+    llvm::MDNode *getHexNode(llvm::LLVMContext &ctx, uint64_t value);
+    bool usesLR(llvm::Value *val);
+    bool classifyFunction(llvm::Function &F, uint64_t pcEnd,
+            std::set<uint64_t> &directCallTargets);
+};
+
+#endif
@@ -120,11 +120,16 @@ ARMDumpThumbBit::runOnModule(Module &module)
     return false;
 }
 
+ARMDumpThumbBit::ARMDumpThumbBit() : llvm::ModulePass(ID)
+{
+    initialize(OutJson);
+}
+
 void
-ARMDumpThumbBit::initialize()
+ARMDumpThumbBit::initialize(const std::string &outJson)
 {
     this->m_thumbPCOutStream = new
-        std::ofstream(OutJson.c_str(), std::ios::out |
+        std::ofstream(outJson.c_str(), std::ios::out |
                 std::ios::binary);
     assert(this->m_thumbPCOutStream);
 }
@@ -33,12 +33,15 @@
 struct ARMDumpThumbBit: public llvm::ModulePass {
     static char ID;
 
-    ARMDumpThumbBit() : llvm::ModulePass(ID) {initialize(); }
+    ARMDumpThumbBit();
+    /* dump to outJson instead of the -outjson path */
+    ARMDumpThumbBit(const std::string &outJson) : llvm::ModulePass(ID)
+        { initialize(outJson); }
     ~ARMDumpThumbBit();
 
     virtual bool runOnModule(llvm::Module &m);
 private:
-    void initialize();
+    void initialize(const std::string &outJson);
     std::ofstream *m_thumbPCOutStream;
     std::list<uint64_t> m_thumbPCs;
     llvm::ConstantInt *getStoreToPCInBB(llvm::BasicBlock *);
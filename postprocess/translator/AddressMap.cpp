@@ -0,0 +1,248 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AddressMap.h"
+#include "FixOverlappedBBs.h"
+
+#include <llvm/Constants.h>
+#include <llvm/Function.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/Instructions.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <vector>
+
+using namespace llvm;
+
+const char AddressMap::Magic[8] = { 'B', '2', 'L', 'A', 'M', 'A', 'P', '1' };
+
+namespace {
+
+struct FuncRecord {
+    uint64_t startPc;
+    uint64_t endPc;
+    uint32_t index;
+    uint32_t flags;
+    std::string name;
+    /* [BB_pcStart, BB_pcEnd) of the translated blocks */
+    std::set<std::pair<uint64_t, uint64_t> > blocks;
+};
+
+struct RangeRecord {
+    uint64_t startPc;
+    uint64_t endPc;
+    uint32_t func;
+
+    bool operator<(const RangeRecord &o) const {
+        if (startPc != o.startPc)
+            return startPc < o.startPc;
+        return func < o.func;
+    }
+};
+
+bool
+byStartPc(const FuncRecord &a, const FuncRecord &b)
+{
+    if (a.startPc != b.startPc)
+        return a.startPc < b.startPc;
+    return a.index < b.index;
+}
+
+void
+put32(std::string &buf, uint32_t v)
+{
+    for (unsigned i = 0; i < 4; ++i)
+        buf.push_back((char) ((v >> (8 * i)) & 0xff));
+}
+
+void
+put64(std::string &buf, uint64_t v)
+{
+    for (unsigned i = 0; i < 8; ++i)
+        buf.push_back((char) ((v >> (8 * i)) & 0xff));
+}
+
+/* store 1, @thumb, the same pattern ARMDumpThumbBit dumps */
+bool
+isThumbStore(StoreInst *store)
+{
+    GlobalVariable *gv = dyn_cast<GlobalVariable>(store->getPointerOperand());
+    if (!gv || gv->getName() != "thumb")
+        return false;
+    ConstantInt *val = dyn_cast<ConstantInt>(store->getValueOperand());
+    return val && val->getZExtValue() == 1;
+}
+
+/*
+ * The PC FunctionRename names the function after: the INS_currPC of the
+ * first instruction, which the optimizations may remove afterwards, so
+ * the name is read back when the function was renamed.
+ */
+bool
+getStartPc(Function &func, uint64_t &pc)
+{
+    StringRef name = func.getName();
+    if (name.startswith("Function_")) {
+        pc = strtoull(name.substr(9).str().c_str(), NULL, 16);
+        return true;
+    }
+    Instruction &first = func.getEntryBlock().front();
+    if (!first.getMetadata("INS_currPC"))
+        return false;
+    pc = FixOverlappedBBs::getHexMetadataFromIns(&first, "INS_currPC");
+    return true;
+}
+
+/*
+ * Every instruction of a translated block carries the BB_pcStart and
+ * BB_pcEnd of the guest block, so the blocks are found as long as one of
+ * their instructions is left, whatever the optimizations removed.
+ */
+bool
+collect(Function &func, uint32_t index, FuncRecord &rec)
+{
+    rec.index = index;
+    rec.flags = 0;
+    rec.name = func.getName().str();
+    if (func.getEntryBlock().empty() || !getStartPc(func, rec.startPc))
+        return false;
+    for (auto bbi = func.begin(), bbe = func.end(); bbi != bbe; ++bbi) {
+        MDNode *last = NULL;
+        for (auto insi = bbi->begin(), inse = bbi->end();
+                insi != inse;
+                ++insi) {
+            if (StoreInst *store = dyn_cast<StoreInst>(insi))
+                if (isThumbStore(store))
+                    rec.flags |= AddressMap::FlagThumb;
+            MDNode *md = insi->getMetadata("BB_pcStart");
+            /* mostly the same node as the previous instruction */
+            if (!md || md == last || !insi->getMetadata("BB_pcEnd"))
+                continue;
+            last = md;
+            uint64_t start = FixOverlappedBBs::
+                getHexMetadataFromIns(insi, "BB_pcStart");
+            uint64_t end = FixOverlappedBBs::
+                getHexMetadataFromIns(insi, "BB_pcEnd");
+            if (end > start)
+                rec.blocks.insert(std::make_pair(start, end));
+        }
+    }
+    return !rec.blocks.empty();
+}
+
+} /* namespace */
+
+bool
+AddressMap::write(Module &m, const std::string &path)
+{
+    std::vector<FuncRecord> funcs;
+    uint32_t index = 0;
+    for (auto funci = m.begin(), funce = m.end();
+            funci != funce;
+            ++funci, ++index) {
+        if (funci->isDeclaration())
+            continue;
+        FuncRecord rec;
+        if (collect(*funci, index, rec))
+            funcs.push_back(rec);
+    }
+    std::sort(funcs.begin(), funcs.end(), byStartPc);
+
+    std::vector<RangeRecord> ranges;
+    std::string names;
+    for (uint32_t f = 0; f < funcs.size(); ++f) {
+        FuncRecord &rec = funcs[f];
+        /* overlapping and adjacent blocks make one range */
+        RangeRecord cur = { 0, 0, f };
+        bool open = false;
+        rec.endPc = 0;
+        for (auto bi = rec.blocks.begin(), be = rec.blocks.end();
+                bi != be;
+                ++bi) {
+            rec.endPc = std::max(rec.endPc, bi->second);
+            if (open && bi->first <= cur.endPc) {
+                cur.endPc = std::max(cur.endPc, bi->second);
+                continue;
+            }
+            if (open)
+                ranges.push_back(cur);
+            cur.startPc = bi->first;
+            cur.endPc = bi->second;
+            open = true;
+        }
+        if (open)
+            ranges.push_back(cur);
+    }
+    std::sort(ranges.begin(), ranges.end());
+
+    uint64_t maxSpan = 0;
+    for (auto ri = ranges.begin(), re = ranges.end(); ri != re; ++ri)
+        maxSpan = std::max(maxSpan, ri->endPc - ri->startPc);
+
+    std::string buf;
+    buf.append(Magic, sizeof(Magic));
+    put32(buf, Version);
+    put32(buf, funcs.size());
+    put32(buf, ranges.size());
+    uint32_t nameBytes = 0;
+    for (auto fi = funcs.begin(), fe = funcs.end(); fi != fe; ++fi)
+        nameBytes += fi->name.size();
+    put32(buf, nameBytes);
+    put64(buf, maxSpan);
+    put64(buf, 0);
+    for (auto fi = funcs.begin(), fe = funcs.end(); fi != fe; ++fi) {
+        put64(buf, fi->startPc);
+        put64(buf, fi->endPc);
+        put32(buf, fi->index);
+        put32(buf, fi->flags);
+        put32(buf, names.size());
+        put32(buf, fi->name.size());
+        names += fi->name;
+    }
+    for (auto ri = ranges.begin(), re = ranges.end(); ri != re; ++ri) {
+        put64(buf, ri->startPc);
+        put64(buf, ri->endPc);
+        put32(buf, ri->func);
+        put32(buf, 0);
+    }
+    buf += names;
+
+    /* readers may have the old map mapped, replace it in one step */
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath.c_str(),
+                std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        out.write(buf.data(), buf.size());
+        if (!out)
+            return false;
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str())) {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    outs() << "[AddressMap] " << funcs.size() << " functions, " <<
+        ranges.size() << " ranges saved to " << path << "\n";
+    return true;
+}
@@ -0,0 +1,75 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ADDRESS_MAP_H__
+#define __ADDRESS_MAP_H__ 1
+
+#include <llvm/Module.h>
+
+#include <cstdint>
+#include <string>
+
+/*
+ * Sidecar file mapping guest addresses to the lifted functions of a
+ * module, so that address queries need neither LLVM nor a scan of the
+ * INS_currPC metadata. All integers are little-endian, every table is
+ * 8 byte aligned and the file can be mmap'ed as is.
+ *
+ *   Header (40 bytes)
+ *     0  char[8]  magic "B2LAMAP1"
+ *     8  u32      version (1)
+ *    12  u32      function count F
+ *    16  u32      range count R
+ *    20  u32      size of the name table in bytes
+ *    24  u64      largest endPc - startPc of a range
+ *    32  u64      reserved (0)
+ *   FuncEntry[F] (32 bytes each), sorted by startPc
+ *     0  u64      startPc, PC the function is named after
+ *     8  u64      endPc, end of the last range (exclusive)
+ *    16  u32      index of the function in the module function list
+ *    20  u32      flags (FlagThumb)
+ *    24  u32      offset of the name in the name table
+ *    28  u32      length of the name
+ *   RangeEntry[R] (24 bytes each), sorted by startPc then function
+ *     0  u64      startPc, start of the first translated block
+ *     8  u64      endPc, end of the last block (exclusive)
+ *    16  u32      position of the owning function in FuncEntry[]
+ *    20  u32      reserved (0)
+ *   char[]        names, not NUL terminated
+ *
+ * The ranges are the BB_pcStart/BB_pcEnd of the translated blocks of a
+ * function, overlapping and adjacent blocks merged. Ranges of different
+ * functions overlap when code is shared. To find every range holding an
+ * address, search the last range starting at or before it and walk back
+ * until startPc + max span is below it.
+ */
+struct AddressMap {
+    enum {
+        Version = 1,
+        FlagThumb = 1,
+        HeaderSize = 40,
+        FuncEntrySize = 32,
+        RangeEntrySize = 24,
+    };
+    static const char Magic[8];
+
+    /* return false if the file could not be written */
+    static bool write(llvm::Module &m, const std::string &path);
+};
+
+#endif
@@ -20,7 +20,10 @@
 #include "FixOverlappedBBs.h"
 
 #include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Constants.h>
 #include <llvm/Function.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Threading.h>
 #include <llvm/Instructions.h>
 #include <llvm/Module.h>
 #include <llvm/Support/raw_ostream.h>
@@ -31,16 +34,66 @@
 #include <llvm/Support/CommandLine.h>
 #include <llvm/LLVMContext.h>
 
+#include <algorithm>
+#include <atomic>
 #include <list>
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
 
 using namespace llvm;
 
 static cl::opt<std::string> OutputFilename("save-funcs", cl::desc("Save functions to file"), cl::value_desc("filename"));
 
+static cl::opt<unsigned> BuildThreads("buildfunctions-threads",
+        cl::desc("Build the functions with this many threads"),
+        cl::init(1));
+
+static cl::opt<bool> OutlineSharedBBs("outline-shared-bbs",
+        cl::desc("Emit blocks reached from more than one function once, "
+            "as shared functions called through a tail call"));
+
+const char *BuildFunctions::SharedPrefix = "shared-func-";
+const char *BuildFunctions::FuncsMetadata = "bin2llvm.funcs";
+
 char BuildFunctions::ID = 0;
 static RegisterPass<BuildFunctions> X("buildfunctions",
         "Build functions from a set of marked BBs.", false, false);
 
+void
+BuildFunctions::getAnalysisUsage(AnalysisUsage &AU) const
+{
+    AU.addRequired<PCIndex>();
+    AU.addPreserved<PCIndex>();
+}
+
+std::string
+BuildFunctions::getOutputName(llvm::Function *start) const
+{
+    if (m_sharedHeads.count(start))
+        return SharedPrefix + std::string(start->getName());
+    return "final-func-" + std::string(start->getName());
+}
+
+llvm::Function *
+BuildFunctions::buildFunction(llvm::Module *newModule, llvm::Function *start,
+        std::list<llvm::Function *> &eraseBBs)
+{
+    llvm::Function *newFunc;
+    if (m_sharedHeads.count(start)) {
+        newFunc = getSharedFunction(newModule, start);
+        newFunc->setLinkage(GlobalValue::InternalLinkage);
+    } else {
+        llvm::Constant *c = newModule->
+            getOrInsertFunction(getOutputName(start),
+                    start->getFunctionType());
+        newFunc = cast<llvm::Function>(c);
+    }
+    makeFunctionForward(newModule, newFunc, start, eraseBBs);
+    return newFunc;
+}
+
 bool BuildFunctions::runOnModule(Module &M)
 {
     std::list<Function *> eraseBBs;
@@ -49,40 +102,56 @@ bool BuildFunctions::runOnModule(Module &M)
     int cnt = 0;
     had_one_switch = false;
 
-    /* build a map with all the entries */
-    for (auto funci = M.begin(), funcie = M.end();
-            funci != funcie;
-            ++funci) {
-        if (!std::strstr(funci->getName().data(), "void-tcg-llvm-tb"))
-            continue;
-        uint64_t pcStart;
-        pcStart = FixOverlappedBBs::getPCStartOfFunc(funci);
-        allBBs[pcStart] = funci;
-    }
+    /* the index holds all the entries */
+    m_index = &getAnalysis<PCIndex>();
 
-    llvm::ValueToValueMapTy valueMap;
-    /* search for entry points */
+    m_sharedHeads.clear();
+    m_clonedBBs = 0;
+    m_sharedTails = 0;
+    if (OutlineSharedBBs)
+        findSharedBlocks(M);
+
+    /* search for entry points, then the shared blocks, in module order */
+    std::vector<llvm::Function *> starts;
     for (auto funci = M.begin(), funcie = M.end();
             funci != funcie;
             ++funci) {
-        if (!std::strstr(funci->getName().data(), "void-tcg-llvm-tb"))
+        const PCIndex::BlockInfo *info = m_index->getInfo(funci);
+        if (!info)
             continue;
         if (!funci->size()) {
             /* function already moved (or removed) */
             continue;
         }
         assert(funci->size());
-        BasicBlock &b = funci->front();
-
-        if (b.getName() == "func_entry_point") {
-            llvm::Constant *c = newModule->
-                getOrInsertFunction("final-func-"+std::string(funci->getName()),
-                        funci->getFunctionType());
-            llvm::Function *newFunc = cast<llvm::Function>(c);
-            makeFunctionForward(newModule, newFunc, funci, eraseBBs);
-            ++cnt;
+
+        if (info->isEntry)
+            starts.push_back(funci);
+    }
+    for (auto funci = M.begin(), funcie = M.end();
+            funci != funcie;
+            ++funci) {
+        if (m_sharedHeads.count(funci))
+            starts.push_back(funci);
+    }
+
+    if (BuildThreads > 1 && starts.size() > 1) {
+        buildParallel(M, newModule, starts, eraseBBs);
+    } else {
+        for (auto starti = starts.begin(), startie = starts.end();
+                starti != startie;
+                ++starti) {
+            buildFunction(newModule, *starti, eraseBBs);
         }
     }
+    cnt = starts.size();
+
+    if (OutlineSharedBBs) {
+        *m_log << "[BuildFunctions] cloned " << m_clonedBBs <<
+            " basic blocks (funcs), " << m_sharedHeads.size() <<
+            " shared functions reached through " << m_sharedTails <<
+            " tail calls\n";
+    }
 
     //outs() << "new-module:\n" << *newModule << "\n";
     //outs() << "----END-NEW\n";
@@ -96,7 +165,8 @@ bool BuildFunctions::runOnModule(Module &M)
         if (funci->size() == 0)
             continue;
         BasicBlock &entry = funci->getEntryBlock();
-        if (entry.getName() != "func_entry_point")
+        if (entry.getName() != "func_entry_point" &&
+                !funci->getName().startswith(SharedPrefix))
             continue;
 
         /* XXX this is an ugly fix for when we have a jump to the
@@ -105,7 +175,7 @@ bool BuildFunctions::runOnModule(Module &M)
          * to copy the metadata
          */
         if (!entry.hasNUses(0)) {
-            outs() << "[BuildFunctionsV] more uses for entry BB " <<
+            *m_log << "[BuildFunctionsV] more uses for entry BB " <<
                 funci->getName() << "\n";
             //    funci->getName() << "\n" << *funci << "\n";
             //errs() << "[BuildFunctionsV] more uses for entry BB" <<
@@ -137,7 +207,9 @@ bool BuildFunctions::runOnModule(Module &M)
         //assert(entry.hasNUses(0));
     }
 
-    outs() << "[BuildFunctions] saving " << cnt << " functions to " <<
+    writeFuncsMetadata(newModule);
+
+    *m_log << "[BuildFunctions] saving " << cnt << " functions to " <<
         OutputFilename << "\n";
 
     std::string error;
@@ -147,13 +219,16 @@ bool BuildFunctions::runOnModule(Module &M)
     llvm::WriteBitcodeToFile(newModule,
             bitcodeOstream);
     bitcodeOstream.close();
+    m_funcsModule = newModule;
 
     /* cleanup unused functions */
     for (auto funci = eraseBBs.begin(), funce = eraseBBs.end();
             funci != funce;
             ++funci) {
-        if ((*funci)->getParent())
+        if ((*funci)->getParent()) {
+            m_index->erase(*funci);
             (*funci)->eraseFromParent();
+        }
     }
 
     if (eraseBBs.size() > 0) {
@@ -162,6 +237,196 @@ bool BuildFunctions::runOnModule(Module &M)
     return false;
 }
 
+/*
+ * A worker builds the functions of the starts it takes from a shared
+ * counter into its own module. It has its own LLVMContext and a lazily
+ * loaded copy of the input module: only the blocks it explores are
+ * materialized.
+ */
+struct BuildFunctions::Worker {
+    const std::string *bitcode;
+    const PCIndex *mainIndex;
+    const std::vector<llvm::Function *> *starts;
+    const std::set<llvm::Function *> *sharedHeads;
+    std::atomic<size_t> *next;
+    /* per start */
+    std::vector<std::string> *logs;
+    std::vector<unsigned> *owner;
+    unsigned id;
+
+    std::string output;
+    std::string error;
+    std::vector<std::string> removed;
+    uint64_t clonedBBs;
+    uint64_t sharedTails;
+    bool hadOneSwitch;
+
+    void run();
+};
+
+void
+BuildFunctions::Worker::run()
+{
+    LLVMContext ctx;
+    std::string error;
+    MemoryBuffer *buffer = MemoryBuffer::getMemBuffer(*bitcode, "", false);
+    Module *m = getLazyBitcodeModule(buffer, ctx, &error);
+    if (!m) {
+        /* nothing was built, the main thread reports it */
+        this->error = error;
+        return;
+    }
+
+    /* the metadata is already parsed, just map it to our functions */
+    PCIndex index;
+    for (auto ii = mainIndex->begin(), iie = mainIndex->end();
+            ii != iie;
+            ++ii) {
+        Function *f = m->getFunction(ii->second->getName());
+        assert(f);
+        index.insert(f, *mainIndex->getInfo(ii->second));
+    }
+
+    BuildFunctions builder;
+    builder.m_index = &index;
+    builder.m_materialize = true;
+    builder.had_one_switch = false;
+    builder.m_clonedBBs = 0;
+    builder.m_sharedTails = 0;
+    for (auto hi = sharedHeads->begin(), hie = sharedHeads->end();
+            hi != hie;
+            ++hi) {
+        builder.m_sharedHeads.insert(m->getFunction((*hi)->getName()));
+    }
+
+    Module *newModule = new Module("Functions", ctx);
+    std::list<Function *> eraseBBs;
+    for (size_t i = (*next)++; i < starts->size(); i = (*next)++) {
+        raw_string_ostream log((*logs)[i]);
+        builder.m_log = &log;
+        builder.m_err = &log;
+        Function *start = m->getFunction((*starts)[i]->getName());
+        builder.buildFunction(newModule, start, eraseBBs);
+        (*owner)[i] = id;
+        log.flush();
+    }
+
+    for (auto funci = eraseBBs.begin(), funce = eraseBBs.end();
+            funci != funce;
+            ++funci) {
+        removed.push_back((*funci)->getName());
+    }
+    clonedBBs = builder.m_clonedBBs;
+    sharedTails = builder.m_sharedTails;
+    hadOneSwitch = builder.had_one_switch;
+
+    raw_string_ostream os(output);
+    WriteBitcodeToFile(newModule, os);
+    os.flush();
+
+    delete newModule;
+    delete m;
+}
+
+void
+BuildFunctions::buildParallel(llvm::Module &M, llvm::Module *newModule,
+        std::vector<llvm::Function *> &starts,
+        std::list<llvm::Function *> &eraseBBs)
+{
+    unsigned threadCnt = std::min<size_t>(BuildThreads, starts.size());
+    std::string bitcode;
+    std::atomic<size_t> next(0);
+    std::vector<std::string> logs(starts.size());
+    std::vector<unsigned> owner(starts.size(), threadCnt);
+    std::vector<Worker> workers(threadCnt);
+    std::vector<std::thread> threads;
+
+    *m_log << "[BuildFunctions] building " << starts.size() <<
+        " functions with " << threadCnt << " threads\n";
+
+    {
+        raw_string_ostream os(bitcode);
+        WriteBitcodeToFile(&M, os);
+    }
+
+    if (!llvm_is_multithreaded())
+        llvm_start_multithreaded();
+    for (unsigned i = 0; i < threadCnt; ++i) {
+        Worker &w = workers[i];
+        w.bitcode = &bitcode;
+        w.mainIndex = m_index;
+        w.starts = &starts;
+        w.sharedHeads = &m_sharedHeads;
+        w.next = &next;
+        w.logs = &logs;
+        w.owner = &owner;
+        w.id = i;
+        threads.push_back(std::thread(&Worker::run, &w));
+    }
+    for (auto ti = threads.begin(), te = threads.end(); ti != te; ++ti)
+        ti->join();
+
+    /* merge in the order of the starts, as the serial build does */
+    std::vector<Module *> built(threadCnt);
+    for (unsigned i = 0; i < threadCnt; ++i) {
+        std::string error;
+        if (!workers[i].error.empty()) {
+            *m_err << "[BuildFunctions] worker " << i << " failed: " <<
+                workers[i].error << "\n";
+        }
+        MemoryBuffer *buffer = MemoryBuffer::getMemBuffer(workers[i].output,
+                "", false);
+        built[i] = ParseBitcodeFile(buffer, newModule->getContext(), &error);
+        delete buffer;
+        if (!built[i]) {
+            /* its functions are built again below */
+            *m_err << "[BuildFunctions] unable to read the functions of " <<
+                "worker " << i << ": " << error << "\n";
+            continue;
+        }
+        m_clonedBBs += workers[i].clonedBBs;
+        m_sharedTails += workers[i].sharedTails;
+        had_one_switch |= workers[i].hadOneSwitch;
+        for (auto ni = workers[i].removed.begin(), ne = workers[i].removed.end();
+                ni != ne;
+                ++ni) {
+            if (Function *f = M.getFunction(*ni))
+                eraseBBs.push_back(f);
+        }
+    }
+
+    llvm::ValueToValueMapTy valueMap;
+    unsigned rebuilt = 0;
+    for (size_t i = 0; i < starts.size(); ++i) {
+        *m_log << logs[i];
+        Function *f = NULL;
+        if (owner[i] < threadCnt && built[owner[i]])
+            f = built[owner[i]]->getFunction(getOutputName(starts[i]));
+        if (!f || f->isDeclaration()) {
+            /* its worker failed, build it here as the serial build does */
+            buildFunction(newModule, starts[i], eraseBBs);
+            ++rebuilt;
+            continue;
+        }
+
+        llvm::Constant *c = newModule->getOrInsertFunction(f->getName(),
+                f->getFunctionType());
+        llvm::Function *newFunc = cast<llvm::Function>(c);
+        newFunc->setLinkage(f->getLinkage());
+
+        llvm::SmallVector<llvm::ReturnInst *, 5> tempList;
+        copyGlobalReferences(newModule, f, valueMap);
+        llvm::CloneFunctionInto(newFunc, f, valueMap, true, tempList);
+    }
+
+    if (rebuilt)
+        *m_err << "[BuildFunctions] rebuilt " << rebuilt <<
+            " functions of failed workers serially\n";
+
+    for (unsigned i = 0; i < threadCnt; ++i)
+        delete built[i];
+}
+
 void
 BuildFunctions::makeFunctionForward(Module *newModule,
         Function *newFunc,
@@ -169,32 +434,34 @@ BuildFunctions::makeFunctionForward(Module *newModule,
         std::list<llvm::Function *> &toBeRemoved)
 {
     std::list<llvm::Function *> BBsForThisFunction;
+    std::list<llvm::Function *> sharedTails;
     bool hasIndirectJump;
     BasicBlock *fakeBB;
 
-    hasIndirectJump = exploreBB(startBB, BBsForThisFunction);
-    fakeBB = inlineBBs(newFunc, BBsForThisFunction, hasIndirectJump);
-    outs() << "[BuildFunctions] function " << newFunc->getName() << " has " <<
+    hasIndirectJump = exploreBB(startBB, BBsForThisFunction, &sharedTails);
+    fakeBB = inlineBBs(newFunc, BBsForThisFunction, sharedTails,
+            hasIndirectJump);
+    m_clonedBBs += BBsForThisFunction.size();
+    m_sharedTails += sharedTails.size();
+    *m_log << "[BuildFunctions] function " << newFunc->getName() << " has " <<
         BBsForThisFunction.size() << " basic blocks (funcs)\n";
 
     assert(!hasIndirectJump || (hasIndirectJump && fakeBB));
 
-    std::map<uint64_t, llvm::BasicBlock *> pcToBB;
-    buildBBMap(newFunc, pcToBB);
-
-    fixupCalls(newFunc, pcToBB);
-    buildBBMap(newFunc, pcToBB);
-
-    fixupDirectJumps(newFunc, pcToBB);
+    /* the fixups only add blocks without a PC (fake_switch*), so the
+     * map built here stays valid for all of them
+     */
+    BBMap pcToBB;
+    FixupBuckets buckets;
     buildBBMap(newFunc, pcToBB);
+    classifyInstructions(newFunc, buckets);
 
-    fixupIndirectJumps(newFunc, pcToBB, fakeBB);
-    buildBBMap(newFunc, pcToBB);
+    fixupCalls(newFunc, pcToBB, buckets);
+    fixupDirectJumps(newFunc, pcToBB, buckets);
+    fixupIndirectJumps(newFunc, pcToBB, fakeBB, buckets);
+    fixupReturns(newFunc, pcToBB, buckets);
 
-    fixupReturns(newFunc, pcToBB);
-    buildBBMap(newFunc, pcToBB);
-
-    outs() << "[BuildFunctions] function " << newFunc->getName() <<
+    *m_log << "[BuildFunctions] function " << newFunc->getName() <<
         " done\n";
 
     /* schedule visited functions for removal */
@@ -205,6 +472,104 @@ BuildFunctions::makeFunctionForward(Module *newModule,
     }
 }
 
+void
+BuildFunctions::writeFuncsMetadata(llvm::Module *module)
+{
+    LLVMContext &ctx = module->getContext();
+    PCIndex index;
+    index.rebuild(*module);
+
+    if (NamedMDNode *old = module->getNamedMetadata(FuncsMetadata))
+        old->eraseFromParent();
+    NamedMDNode *funcs = module->getOrInsertNamedMetadata(FuncsMetadata);
+
+    for (auto funci = module->begin(), funce = module->end();
+            funci != funce;
+            ++funci) {
+        const PCIndex::BlockInfo *info = index.getInfo(funci);
+        if (!info)
+            continue;
+        Value *ops[] = {
+            funci,
+            MDString::get(ctx, FixOverlappedBBs::hex(info->pcStart)),
+            ConstantInt::get(Type::getInt64Ty(ctx), getCoverageScore(funci)),
+            ConstantInt::get(Type::getInt1Ty(ctx),
+                    funci->getName().startswith(SharedPrefix)),
+        };
+        funcs->addOperand(MDNode::get(ctx, ops));
+    }
+}
+
+uint64_t
+BuildFunctions::getCoverageScore(llvm::Function *func)
+{
+    std::set<uint64_t> pcs;
+    uint64_t edges = 0;
+
+    for (auto bbi = func->begin(), bbe = func->end();
+            bbi != bbe;
+            ++bbi) {
+        for (auto insi = bbi->begin(), insie = bbi->end();
+                insi != insie;
+                ++insi) {
+            if (insi->getMetadata("INS_currPC"))
+                pcs.insert(FixOverlappedBBs::getCurrentPCOfIns(insi));
+            if (insi->getMetadata("INS_directCall"))
+                ++edges;
+        }
+        TerminatorInst *term = bbi->getTerminator();
+        if (!term)
+            continue;
+        for (unsigned i = 0, e = term->getNumSuccessors(); i != e; ++i) {
+            if (term->getSuccessor(i)->getName() != "fake_indirect_bb")
+                ++edges;
+        }
+    }
+    return pcs.size() + edges;
+}
+
+llvm::Module *
+BuildFunctions::takeFunctionsModule()
+{
+    llvm::Module *m = m_funcsModule;
+    m_funcsModule = NULL;
+    return m;
+}
+
+/*
+ * Map a global of another module to its declaration in module. Globals
+ * used through a constant expression (a bitcast or GEP of a register)
+ * are mapped too, or the clone would keep pointing in the source
+ * module.
+ */
+static void
+copyGlobalReference(llvm::Module *module, Value *v,
+        llvm::ValueToValueMapTy &valueMap)
+{
+    if (GlobalVariable *globalVar = dyn_cast<GlobalVariable>(v)) {
+        if (valueMap.count(globalVar))
+            return;
+        Constant *newGlobal =
+            module->getOrInsertGlobal(globalVar->getName(),
+                    globalVar->getType()->getElementType());
+        valueMap[globalVar] = newGlobal;
+    } else if (Function *globalFun = dyn_cast<Function>(v)) {
+        if (valueMap.count(globalFun))
+            return;
+        Constant *newGlobal =
+            module->getOrInsertFunction(globalFun->getName(),
+                    globalFun->getFunctionType(),
+                    globalFun->getAttributes());
+        valueMap[globalFun] = newGlobal;
+    } else if (isa<ConstantExpr>(v) || isa<ConstantArray>(v) ||
+            isa<ConstantStruct>(v) || isa<ConstantVector>(v)) {
+        Constant *c = cast<Constant>(v);
+        for (User::op_iterator iob = c->op_begin(), ioe = c->op_end();
+                iob != ioe; ++iob)
+            copyGlobalReference(module, *iob, valueMap);
+    }
+}
+
 void
 BuildFunctions::copyGlobalReferences(
         llvm::Module *module,
@@ -216,30 +581,14 @@ BuildFunctions::copyGlobalReferences(
         for (BasicBlock::iterator iib = ibb->begin(), iie = ibb->end();
                 iib != iie; ++iib) {
             for (User::op_iterator iob = iib->op_begin(), ioe = iib->op_end();
-                    iob != ioe; ++iob) {
-                GlobalVariable *globalVar = dyn_cast<GlobalVariable>(*iob);
-                if (globalVar) {
-                    Constant *newGlobal =
-                        module->getOrInsertGlobal(globalVar->getName(),
-                                globalVar->getType()->getElementType());
-                    valueMap[globalVar] = newGlobal;
-                }
-                Function *globalFun = dyn_cast<Function>(*iob);
-                if (globalFun) {
-                    Constant *newGlobal =
-                        module->getOrInsertFunction(globalFun->getName(),
-                                globalFun->getFunctionType(),
-                                globalFun->getAttributes());
-                    valueMap[globalFun] = newGlobal;
-                }
-            }
+                    iob != ioe; ++iob)
+                copyGlobalReference(module, *iob, valueMap);
         }
     }
 }
 
 void
-BuildFunctions::buildBBMap(llvm::Function *newFunc,
-            std::map<uint64_t, llvm::BasicBlock *> &bbMap)
+BuildFunctions::buildBBMap(llvm::Function *newFunc, BBMap &bbMap)
 {
     bbMap.clear();
     for (auto bbi = newFunc->begin(), bbie = newFunc->end();
@@ -278,9 +627,113 @@ BuildFunctions::buildBBMap(llvm::Function *newFunc,
     }
 }
 
+void
+BuildFunctions::classifyInstructions(llvm::Function *newFunc,
+        FixupBuckets &buckets)
+{
+    for (auto bbi = newFunc->begin(), bbie = newFunc->end();
+            bbi != bbie;
+            ++bbi) {
+        for (auto insi = bbi->begin(), inse = bbi->end();
+                insi != inse;
+                ++insi) {
+            if (!insi->hasMetadata())
+                continue;
+            if (insi->getMetadata("INS_fakeReturn"))
+                buckets.fakeReturns[bbi].push_back(insi);
+
+            if (insi->getMetadata("INS_directCall") ||
+                    insi->getMetadata("INS_indirectCall")) {
+                buckets.calls.push_back(insi);
+            } else if (insi->getMetadata("INS_directJump")) {
+                buckets.directJumps.push_back(insi);
+            } else if (insi->getMetadata("INS_indirectJump")) {
+                buckets.indirectJumps.push_back(insi);
+            } else if (insi->getMetadata("INS_return")) {
+                buckets.returns.push_back(insi);
+            }
+        }
+    }
+}
+
+void
+BuildFunctions::materialize(llvm::Function *f)
+{
+    std::string error;
+    if (m_materialize && f->isMaterializable() && f->Materialize(&error)) {
+        *m_err << "[BuildFunctions] unable to materialize " <<
+            f->getName() << ": " << error << "\n";
+    }
+}
+
+bool
+BuildFunctions::getNextPCs(llvm::Function *f, std::list<uint64_t> &nextPCList)
+{
+    bool hasIndirectJump = false;
+
+    materialize(f);
+
+    for (auto bbi = f->begin(), bbie = f->end();
+            bbi != bbie;
+            ++bbi) {
+        for (auto insi = bbi->begin(), inse = bbi->end();
+                insi != inse;
+                ++insi) {
+            StoreInst *storeInst = dyn_cast<StoreInst>(insi);
+            if (!storeInst)
+                continue;
+
+            GlobalVariable *gv = dyn_cast<GlobalVariable>(storeInst->getOperand(1));
+            if (!(gv && gv->getName() == "PC"))
+                continue;
+
+            /* get next PC */
+            if (storeInst->getMetadata("INS_directCall") ||
+                    storeInst->getMetadata("INS_indirectCall")) {
+                assert(storeInst->getMetadata("INS_callReturn"));
+                uint64_t nextPC =
+                    FixOverlappedBBs::getHexMetadataFromIns(insi,
+                            "INS_callReturn");
+                nextPCList.push_back(nextPC);
+            } else if (storeInst->getMetadata("INS_directJump")) {
+                uint64_t nextPC =
+                    FixOverlappedBBs::getHexMetadataFromIns(insi,
+                            "INS_directJump");
+                nextPCList.push_back(nextPC);
+            } else if (storeInst->getMetadata("INS_indirectJump")) {
+                if (storeInst->getMetadata("INS_switch_cnt")) {
+                    /* we have this indirect jump solved */
+                    uint64_t cnt_entries =
+                        FixOverlappedBBs::getHexMetadataFromIns(storeInst,
+                                "INS_switch_cnt");
+                    /* populate the list with pcs */
+                    for (int i = 0; i < cnt_entries; ++i) {
+                        char buf[512];
+                        snprintf(buf, sizeof buf, "INS_switch_case%d", i);
+                        assert(storeInst->getMetadata(std::string(buf)));
+                        uint64_t target_pc =
+                            FixOverlappedBBs::getHexMetadataFromIns(storeInst,
+                                    std::string(buf));
+                        nextPCList.push_back(target_pc);
+                    }
+                    uint64_t default_pc =
+                        FixOverlappedBBs::getHexMetadataFromIns(storeInst,
+                                "INS_switch_default");
+                    nextPCList.push_back(default_pc);
+                }
+                hasIndirectJump = true;
+            } else {
+                assert(storeInst->getMetadata("INS_return"));
+            }
+        }
+    }
+    return hasIndirectJump;
+}
+
 bool
 BuildFunctions::exploreBB(llvm::Function *startBB,
-            std::list<llvm::Function *> &BBsForThisFunction)
+            std::list<llvm::Function *> &BBsForThisFunction,
+            std::list<llvm::Function *> *sharedTails)
 {
     bool hasIndirectJump = false;
     std::list<llvm::Function *> BBsToBeExpanded;
@@ -295,100 +748,98 @@ BuildFunctions::exploreBB(llvm::Function *startBB,
     while (!BBsToBeExpanded.empty()) {
         Function *f = BBsToBeExpanded.front();
         BBsToBeExpanded.pop_front();
-        outs() << "[BuildFunctions]\texploring " << f->getName() << "\n";
+        *m_log << "[BuildFunctions]\texploring " << f->getName() << "\n";
+
+        std::list<uint64_t> nextPCList;
+        if (getNextPCs(f, nextPCList))
+            hasIndirectJump = true;
+
+        for (auto pci = nextPCList.begin(), pcie = nextPCList.end();
+                pci != pcie; ++pci) {
+            uint64_t nextPC = *pci;
+            Function *nextBB = m_index->lookup(nextPC);
+            if (!nextBB) {
+                *m_err << "[BuildFunctions] call to " <<
+                    FixOverlappedBBs::hex(nextPC) <<
+                    " not found. From: " <<
+                    f->getName() << "\n";
+                continue;
+            }
+            if (exploredBBs.find(nextBB) != exploredBBs.end())
+                continue;
+            exploredBBs[nextBB] = true;
+
+            if (sharedTails && m_sharedHeads.count(nextBB)) {
+                /* emitted once, reached through a tail call */
+                sharedTails->push_back(nextBB);
+                continue;
+            }
+            /* a new bb */
+            BBsToBeExpanded.push_back(nextBB);
+            BBsForThisFunction.push_back(nextBB);
+        }
+    }
+    return hasIndirectJump;
+}
+
+void
+BuildFunctions::findSharedBlocks(llvm::Module &M)
+{
+    std::map<llvm::Function *, unsigned> claims;
 
-        for (auto bbi = f->begin(), bbie = f->end();
+    /* count the functions reaching every block */
+    for (auto funci = M.begin(), funcie = M.end();
+            funci != funcie;
+            ++funci) {
+        const PCIndex::BlockInfo *info = m_index->getInfo(funci);
+        if (!info || !info->isEntry || !funci->size())
+            continue;
+        std::list<llvm::Function *> reached;
+        exploreBB(funci, reached, NULL);
+        for (auto bbi = reached.begin(), bbie = reached.end();
                 bbi != bbie;
                 ++bbi) {
-            for (auto insi = bbi->begin(), inse = bbi->end();
-                    insi != inse;
-                    ++insi) {
-                StoreInst *storeInst = dyn_cast<StoreInst>(insi);
-                if (!storeInst)
-                    continue;
-
-                GlobalVariable *gv = dyn_cast<GlobalVariable>(storeInst->getOperand(1));
-                if (!(gv && gv->getName() == "PC"))
-                    continue;
-
-                /* get next PC */
-                uint64_t nextPC;
-                std::list<uint64_t> nextPCList;
-                bool isNextPCValid = false;
-
-                if (storeInst->getMetadata("INS_directCall") ||
-                        storeInst->getMetadata("INS_indirectCall")) {
-                    assert(storeInst->getMetadata("INS_callReturn"));
-                    uint64_t nextPC =
-                        FixOverlappedBBs::getHexMetadataFromIns(insi,
-                                "INS_callReturn");
-                    nextPCList.push_back(nextPC);
-                    isNextPCValid = true;
-                } else if (storeInst->getMetadata("INS_directJump")) {
-                    uint64_t nextPC =
-                        FixOverlappedBBs::getHexMetadataFromIns(insi,
-                                "INS_directJump");
-                    nextPCList.push_back(nextPC);
-                    isNextPCValid = true;
-                } else if (storeInst->getMetadata("INS_indirectJump")) {
-                    if (storeInst->getMetadata("INS_switch_cnt")) {
-                        /* we have this indirect jump solved */
-                        uint64_t cnt_entries =
-                            FixOverlappedBBs::getHexMetadataFromIns(storeInst,
-                                    "INS_switch_cnt");
-                        /* populate the list with pcs */
-                        for (int i = 0; i < cnt_entries; ++i) {
-                            char buf[512];
-                            snprintf(buf, sizeof buf, "INS_switch_case%d", i);
-                            assert(storeInst->getMetadata(std::string(buf)));
-                            uint64_t target_pc =
-                                FixOverlappedBBs::getHexMetadataFromIns(storeInst,
-                                        std::string(buf));
-                            nextPCList.push_back(target_pc);
-                        }
-                        uint64_t default_pc =
-                            FixOverlappedBBs::getHexMetadataFromIns(storeInst,
-                                    "INS_switch_default");
-                        nextPCList.push_back(default_pc);
-                        isNextPCValid = true;
-                    }
-                    hasIndirectJump = true;
-                } else {
-                    assert(storeInst->getMetadata("INS_return"));
-                }
-
+            ++claims[*bbi];
+        }
+    }
 
-                if (isNextPCValid) {
-                    for (auto pci = nextPCList.begin(), pcie = nextPCList.end();
-                            pci != pcie; ++pci) {
-                        uint64_t nextPC = *pci;
-                        if (allBBs.find(nextPC) == allBBs.end()) {
-                            errs() << "[BuildFunctions] call to " <<
-                                FixOverlappedBBs::hex(nextPC) <<
-                                " not found. Ins: " <<
-                                *storeInst << "\n";
-                            continue;
-                        }
-                        assert(allBBs.find(nextPC) != allBBs.end());
-                        Function *nextBB = allBBs[nextPC];
-                        assert(nextBB);
-                        if (exploredBBs.find(nextBB) == exploredBBs.end()) {
-                            /* a new bb */
-                            BBsToBeExpanded.push_back(nextBB);
-                            BBsForThisFunction.push_back(nextBB);
-                            exploredBBs[nextBB] = true;
-                        }
-                    }
-                }
-            }
+    /* anyone reaching a block also reaches its successors, so the
+     * claims only grow along an edge. A shared block is outlined where
+     * they grow: the rest of the shared code comes along with it.
+     */
+    for (auto ci = claims.begin(), cie = claims.end();
+            ci != cie;
+            ++ci) {
+        std::list<uint64_t> nextPCList;
+        getNextPCs(ci->first, nextPCList);
+        for (auto pci = nextPCList.begin(), pcie = nextPCList.end();
+                pci != pcie; ++pci) {
+            Function *nextBB = m_index->lookup(*pci);
+            if (!nextBB || m_index->getInfo(nextBB)->isEntry)
+                continue;
+            unsigned nextClaims = claims[nextBB];
+            if (nextClaims >= 2 && nextClaims > ci->second)
+                m_sharedHeads.insert(nextBB);
         }
     }
-    return hasIndirectJump;
+    *m_log << "[BuildFunctions] " << m_sharedHeads.size() <<
+        " shared blocks will be outlined\n";
+}
+
+llvm::Function *
+BuildFunctions::getSharedFunction(llvm::Module *newModule,
+        llvm::Function *head)
+{
+    llvm::Constant *c = newModule->getOrInsertFunction(
+            SharedPrefix + std::string(head->getName()),
+            head->getFunctionType());
+    return cast<llvm::Function>(c);
 }
 
 BasicBlock *
 BuildFunctions::inlineBBs(llvm::Function *newFunc,
         std::list<llvm::Function *> &BBsForThisFunction,
+        std::list<llvm::Function *> &sharedTails,
         bool hasIndirectJump)
 {
     llvm::ValueToValueMapTy valueMap;
@@ -400,6 +851,28 @@ BuildFunctions::inlineBBs(llvm::Function *newFunc,
         llvm::CloneFunctionInto(newFunc, *funci, valueMap, true, tempList);
     }
 
+    /* a shared block is replaced by a stub with its PC: the fixups
+     * branch to the stub, which tail calls the shared function
+     */
+    LLVMContext &ctx = newFunc->getContext();
+    for (auto funci = sharedTails.begin(), funce = sharedTails.end();
+            funci != funce;
+            ++funci) {
+        materialize(*funci);
+        MDNode *pcStart =
+            (*funci)->getEntryBlock().front().getMetadata("BB_pcStart");
+        assert(pcStart);
+        assert((*funci)->arg_empty());
+
+        BasicBlock *stubBB = BasicBlock::Create(ctx, "shared_tail", newFunc);
+        CallInst *call = CallInst::Create(
+                getSharedFunction(newFunc->getParent(), *funci), "", stubBB);
+        call->setTailCall();
+        call->setMetadata("BB_pcStart", pcStart);
+        call->setMetadata("INS_sharedTail", pcStart);
+        ReturnInst::Create(ctx, stubBB);
+    }
+
     if (hasIndirectJump) {
         /* create a fake bb for solving the indirect jumps */
         BasicBlock *fakeBB = BasicBlock::Create(newFunc->getContext(),
@@ -412,42 +885,38 @@ BuildFunctions::inlineBBs(llvm::Function *newFunc,
 }
 
 void
-BuildFunctions::fixupCalls(llvm::Function *newFunc,
-            std::map<uint64_t, llvm::BasicBlock *> &bbMap)
+BuildFunctions::fixupCalls(llvm::Function *newFunc, BBMap &bbMap,
+        FixupBuckets &buckets)
 {
     std::map<BasicBlock *, BasicBlock *> bbToTargetBB;
     std::list<BasicBlock *> bbToUpdate;
 
-    for (auto bbi = newFunc->begin(), bbie = newFunc->end();
-            bbi != bbie;
-            ++bbi) {
-        for (auto insi = bbi->begin(), inse = bbi->end();
-                insi != inse;
-                ++insi) {
-            if (insi->getMetadata("INS_directCall") ||
-                    insi->getMetadata("INS_indirectCall")) {
-                assert(insi->getMetadata("INS_callReturn"));
-
-                uint64_t nextPC =
-                    FixOverlappedBBs::getHexMetadataFromIns(insi,
-                            "INS_callReturn");
-                BasicBlock *bbTarget = bbMap[nextPC];
-                if (!bbTarget) {
-                    insi->setMetadata("INS_unresolvedCall",
-                            MDNode::get(insi->getContext(),
-                                MDString::get(insi->getContext(),
-                                    std::string("true"))));
-                    continue;
-                }
-                //if (!bbTarget)
-                    //bbTarget = getOrCreateEmptyFunction(newFunc->getParent());
-                //assert(bbTarget);
-
-                assert(bbToTargetBB.find(bbi) == bbToTargetBB.end());
-                bbToTargetBB[bbi] = bbTarget;
-                bbToUpdate.push_back(bbi);
-            }
+    for (auto insi = buckets.calls.begin(), inse = buckets.calls.end();
+            insi != inse;
+            ++insi) {
+        Instruction *ins = *insi;
+        BasicBlock *bb = ins->getParent();
+        assert(ins->getMetadata("INS_callReturn"));
+
+        uint64_t nextPC =
+            FixOverlappedBBs::getHexMetadataFromIns(ins,
+                    "INS_callReturn");
+        auto target = bbMap.find(nextPC);
+        if (target == bbMap.end()) {
+            ins->setMetadata("INS_unresolvedCall",
+                    MDNode::get(ins->getContext(),
+                        MDString::get(ins->getContext(),
+                            std::string("true"))));
+            continue;
         }
+        BasicBlock *bbTarget = target->second;
+        //if (!bbTarget)
+            //bbTarget = getOrCreateEmptyFunction(newFunc->getParent());
+        assert(bbTarget);
+
+        assert(bbToTargetBB.find(bb) == bbToTargetBB.end());
+        bbToTargetBB[bb] = bbTarget;
+        bbToUpdate.push_back(bb);
     }
 
     for (auto bbi = bbToUpdate.begin(), bbie = bbToUpdate.end();
@@ -458,45 +927,41 @@ BuildFunctions::fixupCalls(llvm::Function *newFunc,
         BranchInst *bi = BranchInst::Create(bbTarget, *bbi);
     }
 
-    cleanupFakeReturns(bbToUpdate);
+    cleanupFakeReturns(bbToUpdate, buckets);
 
-    outs() << "[BuildFunctions]\t\tupdated " << bbToUpdate.size() <<
+    *m_log << "[BuildFunctions]\t\tupdated " << bbToUpdate.size() <<
         " {direct,indirect}Calls\n";
 }
 
 void
-BuildFunctions::fixupDirectJumps(llvm::Function *newFunc,
-            std::map<uint64_t, llvm::BasicBlock *> &bbMap)
+BuildFunctions::fixupDirectJumps(llvm::Function *newFunc, BBMap &bbMap,
+        FixupBuckets &buckets)
 {
     std::map<Instruction *, BasicBlock *> insToTargetBB;
     std::list<Instruction *> insToUpdate;
     std::list<BasicBlock *> bbToUpdate;
 
-    for (auto bbi = newFunc->begin(), bbie = newFunc->end();
-            bbi != bbie;
-            ++bbi) {
-        for (auto insi = bbi->begin(), inse = bbi->end();
-                insi != inse;
-                ++insi) {
-            if (insi->getMetadata("INS_directJump")) {
-                uint64_t nextPC =
-                    FixOverlappedBBs::getHexMetadataFromIns(insi,
-                            "INS_directJump");
-                if (bbMap.find(nextPC) == bbMap.end()) {
-                    errs() << "[BuildFunctions] unable to resolve directJump"
-                        << *insi << " " << FixOverlappedBBs::hex(nextPC) << "\n";
-                    continue;
-                }
-                BasicBlock *bbTarget = bbMap[nextPC];
-                assert(bbTarget);
+    for (auto insi = buckets.directJumps.begin(),
+            inse = buckets.directJumps.end();
+            insi != inse;
+            ++insi) {
+        Instruction *ins = *insi;
+        uint64_t nextPC =
+            FixOverlappedBBs::getHexMetadataFromIns(ins,
+                    "INS_directJump");
+        if (bbMap.find(nextPC) == bbMap.end()) {
+            *m_err << "[BuildFunctions] unable to resolve directJump"
+                << *ins << " " << FixOverlappedBBs::hex(nextPC) << "\n";
+            continue;
+        }
+        BasicBlock *bbTarget = bbMap[nextPC];
+        assert(bbTarget);
 
-                assert(insToTargetBB.find(insi) == insToTargetBB.end());
-                insToTargetBB[insi] = bbTarget;
+        assert(insToTargetBB.find(ins) == insToTargetBB.end());
+        insToTargetBB[ins] = bbTarget;
 
-                insToUpdate.push_back(insi);
-                bbToUpdate.push_back(bbi);
-            }
-        }
+        insToUpdate.push_back(ins);
+        bbToUpdate.push_back(ins->getParent());
     }
 
     for (auto insi = insToUpdate.begin(), insie = insToUpdate.end();
@@ -513,35 +978,31 @@ BuildFunctions::fixupDirectJumps(llvm::Function *newFunc,
         //ReplaceInstWithInst(*insi, bi);
     }
 
-    cleanupFakeReturns(bbToUpdate);
+    cleanupFakeReturns(bbToUpdate, buckets);
 
-    outs() << "[BuildFunctions]\t\tupdated " << insToUpdate.size() <<
+    *m_log << "[BuildFunctions]\t\tupdated " << insToUpdate.size() <<
         " directJumps\n";
 }
 
 void BuildFunctions::fixupIndirectJumps(llvm::Function *newFunc,
-            std::map<uint64_t, llvm::BasicBlock *> &bbMap,
-            llvm::BasicBlock *fakeBB)
+        BBMap &bbMap,
+        llvm::BasicBlock *fakeBB,
+        FixupBuckets &buckets)
 {
     std::list<Instruction *> insToUpdate;
     std::list<Instruction *> transformToSwitch;
     std::list<BasicBlock *> bbToUpdate;
 
-    for (auto bbi = newFunc->begin(), bbie = newFunc->end();
-            bbi != bbie;
-            ++bbi) {
-        for (auto insi = bbi->begin(), inse = bbi->end();
-                insi != inse;
-                ++insi) {
-            if (insi->getMetadata("INS_indirectJump")) {
-                if (insi->getMetadata("INS_switch_cnt")) {
-                    transformToSwitch.push_back(insi);
-                } else {
-                    insToUpdate.push_back(insi);
-                }
-                bbToUpdate.push_back(bbi);
-            }
+    for (auto insi = buckets.indirectJumps.begin(),
+            inse = buckets.indirectJumps.end();
+            insi != inse;
+            ++insi) {
+        if ((*insi)->getMetadata("INS_switch_cnt")) {
+            transformToSwitch.push_back(*insi);
+        } else {
+            insToUpdate.push_back(*insi);
         }
+        bbToUpdate.push_back((*insi)->getParent());
     }
     BasicBlock *myfakeBB = fakeBB;
 
@@ -553,7 +1014,7 @@ void BuildFunctions::fixupIndirectJumps(llvm::Function *newFunc,
                 !(*insi)->getMetadata("INS_switch_cnt") ||
                 !(*insi)->getMetadata("INS_switch_idx_start")) {
             /* skip this, it is borken */
-            errs() << "[BuildFunctionsSW]\tswitch wrong metadata\n";
+            *m_err << "[BuildFunctionsSW]\tswitch wrong metadata\n";
             insToUpdate.push_back(*insi);
             continue;
         }
@@ -567,14 +1028,14 @@ void BuildFunctions::fixupIndirectJumps(llvm::Function *newFunc,
             FixOverlappedBBs::getHexMetadataFromIns(*insi,
                     "INS_switch_idx_start");
         BasicBlock *bb_default = NULL;
-        outs() << "[BuildFunctionsSW]\tcreating switch\n";
+        *m_log << "[BuildFunctionsSW]\tcreating switch\n";
         /* insi is a store op to PC */
         Value *op = getValueSwitchedOn(*insi);
         if (!op)
             continue;
         if (bbMap.find(default_pc) == bbMap.end()) {
             /* cannot find default bb */
-            outs() << "[BuildFunctionsSW]\tcannot find default bb " <<
+            *m_log << "[BuildFunctionsSW]\tcannot find default bb " <<
                 FixOverlappedBBs::hex(default_pc) << "\n";
             /**/
             if (myfakeBB == NULL) {
@@ -613,7 +1074,7 @@ void BuildFunctions::fixupIndirectJumps(llvm::Function *newFunc,
                         ReturnInst::Create(newFunc->getContext(), myfakeBB);
                 }
                 bb_target = myfakeBB;
-                outs() << "[BuildFunctionsSW]\tfailed to find switch case bb: " <<
+                *m_log << "[BuildFunctionsSW]\tfailed to find switch case bb: " <<
                     i << " " << FixOverlappedBBs::hex(target_pc) << "\n";
             } else {
                 bb_target = bbMap[target_pc];
@@ -627,7 +1088,7 @@ void BuildFunctions::fixupIndirectJumps(llvm::Function *newFunc,
             /* really add the case */
             sw->addCase(onValue, bb_target);
         }
-        outs() << "[BuildFunctionsSW]\tadded " << cnt_entries << " cases\n";
+        *m_log << "[BuildFunctionsSW]\tadded " << cnt_entries << " cases\n";
         had_one_switch = true;
     }
 
@@ -638,9 +1099,9 @@ void BuildFunctions::fixupIndirectJumps(llvm::Function *newFunc,
         //(*insi)->eraseFromParent();
     }
 
-    cleanupFakeReturns(bbToUpdate);
+    cleanupFakeReturns(bbToUpdate, buckets);
 
-    outs() << "[BuildFunctions]\t\tupdated " << insToUpdate.size() <<
+    *m_log << "[BuildFunctions]\t\tupdated " << insToUpdate.size() <<
         " indirectJumps\n";
 }
 
@@ -660,22 +1121,16 @@ BuildFunctions::getOrCreateEmptyFunction(Module *m)
 }
 
 void BuildFunctions::fixupReturns(llvm::Function *newFunc,
-            std::map<uint64_t, llvm::BasicBlock *> &bbMap)
+        BBMap &bbMap,
+        FixupBuckets &buckets)
 {
-    std::list<Instruction *> insToUpdate;
+    std::list<Instruction *> &insToUpdate = buckets.returns;
     std::list<BasicBlock *> bbToUpdate;
 
-    for (auto bbi = newFunc->begin(), bbie = newFunc->end();
-            bbi != bbie;
-            ++bbi) {
-        for (auto insi = bbi->begin(), inse = bbi->end();
-                insi != inse;
-                ++insi) {
-            if (insi->getMetadata("INS_return")) {
-                insToUpdate.push_back(insi);
-                bbToUpdate.push_back(bbi);
-            }
-        }
+    for (auto insi = insToUpdate.begin(), inse = insToUpdate.end();
+            insi != inse;
+            ++insi) {
+        bbToUpdate.push_back((*insi)->getParent());
     }
 
     for (auto insi = insToUpdate.begin(), insie = insToUpdate.end();
@@ -689,32 +1144,29 @@ void BuildFunctions::fixupReturns(llvm::Function *newFunc,
         (*insi)->eraseFromParent();
         //ReplaceInstWithInst(*insi, bi);
     }
-    cleanupFakeReturns(bbToUpdate);
+    cleanupFakeReturns(bbToUpdate, buckets);
 
-    outs() << "[BuildFunctions]\t\tupdated " << insToUpdate.size() <<
+    *m_log << "[BuildFunctions]\t\tupdated " << insToUpdate.size() <<
         " returns\n";
 }
 
 void
-BuildFunctions::cleanupFakeReturns(std::list<llvm::BasicBlock *> &bbToUpdate)
+BuildFunctions::cleanupFakeReturns(std::list<llvm::BasicBlock *> &bbToUpdate,
+        FixupBuckets &buckets)
 {
-    std::list<Instruction *> removeMe;
     /* remove fake returns */
     for (auto bbi = bbToUpdate.begin(), bbie = bbToUpdate.end();
             bbi != bbie;
             ++bbi) {
-        for (auto insi = (*bbi)->begin(), inse = (*bbi)->end();
+        auto fake = buckets.fakeReturns.find(*bbi);
+        if (fake == buckets.fakeReturns.end())
+            continue;
+        for (auto insi = fake->second.begin(), inse = fake->second.end();
                 insi != inse;
                 ++insi) {
-            if (insi->getMetadata("INS_fakeReturn")) {
-                removeMe.push_back(insi);
-            }
+            (*insi)->eraseFromParent();
         }
-    }
-    for (auto insi = removeMe.begin(), inse = removeMe.end();
-            insi != inse;
-            ++insi) {
-        (*insi)->eraseFromParent();
+        buckets.fakeReturns.erase(fake);
     }
 }
 
@@ -724,7 +1176,7 @@ BuildFunctions::getValueSwitchedOn(llvm::Instruction *storeToPC)
     Value *ret = __getValueSwitchedOn(storeToPC->getOperand(0),
             storeToPC->getParent());
     if (!ret) {
-        outs() << "[BuildFunctionsSW]\t\tfailed to get idx op\n";
+        *m_log << "[BuildFunctionsSW]\t\tfailed to get idx op\n";
     }
     return ret;
 }
@@ -746,7 +1198,7 @@ BuildFunctions::__getValueSwitchedOn(Value *v, BasicBlock *origBB)
         if (w->getZExtValue() == 1 ||
                 w->getZExtValue() == 2) {
             /* we got it */
-            outs() << "[BuildFunctionsSW]\t\tmatched idx, op0 from: " <<
+            *m_log << "[BuildFunctionsSW]\t\tmatched idx, op0 from: " <<
                 *ins << "\n";
             return ins->getOperand(0);
         }
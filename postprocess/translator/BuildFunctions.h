@@ -26,52 +26,132 @@
 #include <llvm/Transforms/Utils/ValueMapper.h>
 #include <llvm/Constants.h>
 
+#include <llvm/Support/raw_ostream.h>
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "PCIndex.h"
+
 /*
  * This pass builds functions from basic blocks. The basic blocks have
  * been renamed as entry bb and the calls (direct and indirect) are
  * already marked through metadata. Also the retuns instructions are
  * marked with metadata.
  * The new functions are exported to functions.bc
+ *
+ * With -outline-shared-bbs, the blocks reached from more than one entry
+ * are not cloned into every function. They are emitted once, as an
+ * internal shared-func-* function, and the reaching functions jump to a
+ * stub that tail calls it. The call is tagged with INS_sharedTail (the
+ * PC of the shared block) so the linker can relink it.
+ *
+ * With -buildfunctions-threads N, the functions are built by N workers,
+ * each with its own LLVMContext and lazily loaded copy of the module,
+ * and merged into the output in the serial order.
  */
 struct BuildFunctions : public llvm::ModulePass {
     static char ID;
 
-    BuildFunctions() : llvm::ModulePass(ID) {}
+    BuildFunctions() : llvm::ModulePass(ID), m_log(&llvm::outs()),
+        m_err(&llvm::errs()), m_materialize(false), m_funcsModule(NULL) {}
 
     virtual bool runOnModule(llvm::Module &M);
+    virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
     static void copyGlobalReferences(
         llvm::Module *module,
         llvm::Function *func,
         llvm::ValueToValueMapTy &valueMap);
+
+    static const char *SharedPrefix;
+    /* named metadata listing the built functions as (function, start pc,
+     * coverage score, shared) tuples, so readers can pick functions
+     * without materializing them. A shared function starts at the PC of
+     * its head, which may also be the entry of a function.
+     */
+    static const char *FuncsMetadata;
+    static void writeFuncsMetadata(llvm::Module *module);
+    /* distinct instruction PCs plus resolved edges (CFG edges other than
+     * to the fake indirect block, and direct calls)
+     */
+    static uint64_t getCoverageScore(llvm::Function *func);
+    /* the module saved to -save-funcs by the last run, the caller owns
+     * it afterwards. Lets an in-process pipeline skip reading it back.
+     */
+    llvm::Module *takeFunctionsModule();
 private:
+    struct Worker;
+
+    std::string getOutputName(llvm::Function *start) const;
+    llvm::Function *buildFunction(llvm::Module *newModule,
+            llvm::Function *start,
+            std::list<llvm::Function *> &eraseBBs);
+    void buildParallel(llvm::Module &M, llvm::Module *newModule,
+            std::vector<llvm::Function *> &starts,
+            std::list<llvm::Function *> &eraseBBs);
+    void materialize(llvm::Function *f);
     void makeFunctionForward(llvm::Module *newModule,
             llvm::Function *newFunc,
             llvm::Function *startBB,
             std::list<llvm::Function *> &toBeRemoved);
-    std::map<uint64_t, llvm::Function *> allBBs;
-    void buildBBMap(llvm::Function *newFunc,
-            std::map<uint64_t, llvm::BasicBlock *> &bbMap);
+    PCIndex *m_index;
+    typedef std::map<uint64_t, llvm::BasicBlock *> BBMap;
+    /* instructions carrying a control flow mark, gathered in one walk */
+    struct FixupBuckets {
+        std::list<llvm::Instruction *> calls;
+        std::list<llvm::Instruction *> directJumps;
+        std::list<llvm::Instruction *> indirectJumps;
+        std::list<llvm::Instruction *> returns;
+        std::map<llvm::BasicBlock *, std::list<llvm::Instruction *> >
+            fakeReturns;
+    };
+    void buildBBMap(llvm::Function *newFunc, BBMap &bbMap);
+    void classifyInstructions(llvm::Function *newFunc,
+            FixupBuckets &buckets);
     /* return true if we have an indirectJump */
+    bool getNextPCs(llvm::Function *f, std::list<uint64_t> &nextPCList);
+    /* return true if we have an indirectJump. If sharedTails is given,
+     * the exploration stops at the shared blocks, which are added there
+     */
     bool exploreBB(llvm::Function *startBB,
-            std::list<llvm::Function *> &BBsForThisFunction);
+            std::list<llvm::Function *> &BBsForThisFunction,
+            std::list<llvm::Function *> *sharedTails);
+    void findSharedBlocks(llvm::Module &M);
+    llvm::Function *getSharedFunction(llvm::Module *newModule,
+            llvm::Function *head);
     /* inline bbs */
     llvm::BasicBlock *inlineBBs(llvm::Function *newFunc,
             std::list<llvm::Function *> &BBsForThisFunction,
+            std::list<llvm::Function *> &sharedTails,
             bool hasIndirectJump);
-    void fixupCalls(llvm::Function *newFunc,
-            std::map<uint64_t, llvm::BasicBlock *> &bbMap);
-    void fixupDirectJumps(llvm::Function *newFunc,
-            std::map<uint64_t, llvm::BasicBlock *> &bbMap);
-    void fixupIndirectJumps(llvm::Function *newFunc,
-            std::map<uint64_t, llvm::BasicBlock *> &bbMap,
-            llvm::BasicBlock *fakeBB);
-    void fixupReturns(llvm::Function *newFunc,
-            std::map<uint64_t, llvm::BasicBlock *> &bbMap);
-    void cleanupFakeReturns(std::list<llvm::BasicBlock *> &bbToUpdate);
+    void fixupCalls(llvm::Function *newFunc, BBMap &bbMap,
+            FixupBuckets &buckets);
+    void fixupDirectJumps(llvm::Function *newFunc, BBMap &bbMap,
+            FixupBuckets &buckets);
+    void fixupIndirectJumps(llvm::Function *newFunc, BBMap &bbMap,
+            llvm::BasicBlock *fakeBB, FixupBuckets &buckets);
+    void fixupReturns(llvm::Function *newFunc, BBMap &bbMap,
+            FixupBuckets &buckets);
+    void cleanupFakeReturns(std::list<llvm::BasicBlock *> &bbToUpdate,
+            FixupBuckets &buckets);
     llvm::BasicBlock *getOrCreateEmptyFunction(llvm::Module *m);
     llvm::Function *m_fakeFunction;
     bool had_one_switch;
 
+    std::set<llvm::Function *> m_sharedHeads;
+    uint64_t m_clonedBBs;
+    uint64_t m_sharedTails;
+
+    /* the workers log to a buffer per function */
+    llvm::raw_ostream *m_log;
+    llvm::raw_ostream *m_err;
+    /* the tcg blocks may not be materialized yet */
+    bool m_materialize;
+    llvm::Module *m_funcsModule;
+
     llvm::Value *getValueSwitchedOn(llvm::Instruction *storeToPC);
     llvm::Value *__getValueSwitchedOn(llvm::Value *v, llvm::BasicBlock *origBB);
 };
@@ -0,0 +1,218 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ConstantMemory.h"
+
+#include "FixOverlappedBBs.h"
+#include "PassUtils.h"
+
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/SwapByteOrder.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace llvm;
+
+static cl::list<std::string> MemoryDescriptors(
+        "memory",
+        cl::desc("path-to-file@0xL0ADADD7"));
+
+static cl::list<std::string> ReadOnlyMemoryDescriptors(
+        "memory-ro",
+        cl::desc("path-to-file@0xL0ADADD7, mapped read-only in the firmware"));
+
+static cl::opt<bool> IsBigEndian("is-big-endian",
+        cl::desc("Set big endian."));
+
+static bool
+segmentStartLess(uint64_t address, const ConstantMemory::Segment &s)
+{
+    return address < s.start;
+}
+
+static bool
+segmentLess(const ConstantMemory::Segment &a,
+        const ConstantMemory::Segment &b)
+{
+    return a.start < b.start;
+}
+
+ConstantMemory::ConstantMemory(bool isBigEndian) :
+    m_isBigEndian(isBigEndian),
+    m_swap(isBigEndian != sys::isBigEndianHost())
+{
+}
+
+ConstantMemory::~ConstantMemory()
+{
+    for (auto si = m_segments.begin(), se = m_segments.end();
+            si != se;
+            ++si) {
+        munmap(const_cast<uint8_t *>(si->data), si->mapLen);
+    }
+}
+
+ConstantMemory *
+ConstantMemory::fromCommandLine()
+{
+    ConstantMemory *mem = new ConstantMemory(IsBigEndian);
+
+    for (auto desci = MemoryDescriptors.begin(), descie = MemoryDescriptors.end();
+            desci != descie;
+            ++desci) {
+        mem->addPool(*desci);
+    }
+    for (auto desci = ReadOnlyMemoryDescriptors.begin(),
+            descie = ReadOnlyMemoryDescriptors.end();
+            desci != descie;
+            ++desci) {
+        mem->addPool(*desci, true);
+    }
+    return mem;
+}
+
+bool
+ConstantMemory::addPool(const std::string &desc, bool readOnly)
+{
+    std::string::size_type atPos = desc.rfind('@');
+
+    assert(atPos != std::string::npos);
+    std::string path = desc.substr(0, atPos);
+    uint64_t addr = strtoull(desc.substr(atPos+1).c_str(), NULL, 16);
+
+    return addPool(path, addr, readOnly);
+}
+
+bool
+ConstantMemory::addPool(const std::string &path, uint64_t start,
+        bool readOnly)
+{
+    outs() << "[ConstantMemory] adding " << (readOnly ? "read-only " : "") <<
+        "pool from file " << path << "@" << FixOverlappedBBs::hex(start) <<
+        "\n";
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        errs() << "[ConstantMemory] unable to open " << path << "\n";
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        errs() << "[ConstantMemory] empty or unreadable " << path << "\n";
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        errs() << "[ConstantMemory] unable to map " << path << "\n";
+        return false;
+    }
+
+    Segment seg;
+    seg.start = start;
+    seg.end = start + st.st_size;
+    seg.data = static_cast<const uint8_t *>(data);
+    seg.mapLen = st.st_size;
+    seg.path = path;
+    seg.readOnly = readOnly;
+
+    auto pos = std::upper_bound(m_segments.begin(), m_segments.end(),
+            seg, segmentLess);
+    if ((pos != m_segments.end() && pos->start < seg.end) ||
+            (pos != m_segments.begin() && (pos-1)->end > seg.start)) {
+        WARNING("[ConstantMemory] " << path << " overlaps another pool");
+    }
+    m_segments.insert(pos, seg);
+
+    return true;
+}
+
+const ConstantMemory::Segment *
+ConstantMemory::find(uint64_t address, unsigned byteCnt) const
+{
+    /* first segment starting after address, the candidate is the one
+     * before it
+     */
+    auto si = std::upper_bound(m_segments.begin(), m_segments.end(),
+            address, segmentStartLess);
+    if (si == m_segments.begin())
+        return NULL;
+    --si;
+    if (address + byteCnt > si->end || address + byteCnt < address)
+        return NULL;
+    return &*si;
+}
+
+bool
+ConstantMemory::contains(uint64_t address, unsigned byteCnt) const
+{
+    return find(address, byteCnt) != NULL;
+}
+
+bool
+ConstantMemory::read(uint64_t address, unsigned byteCnt,
+        uint64_t &value, bool onlyReadOnly) const
+{
+    const Segment *seg = find(address, byteCnt);
+    if (!seg || (onlyReadOnly && !seg->readOnly))
+        return false;
+
+    const uint8_t *p = seg->data + (address - seg->start);
+    switch (byteCnt) {
+    case 1:
+        value = *p;
+        break;
+    case 2: {
+        uint16_t v;
+        std::memcpy(&v, p, sizeof v);
+        value = m_swap ? sys::SwapByteOrder_16(v) : v;
+        break;
+    }
+    case 4: {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof v);
+        value = m_swap ? sys::SwapByteOrder_32(v) : v;
+        break;
+    }
+    case 8: {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof v);
+        value = m_swap ? sys::SwapByteOrder_64(v) : v;
+        break;
+    }
+    default:
+        assert(0 && "unsupported load size");
+        return false;
+    }
+
+    DBG("[ConstantMemory] load cst [" << FixOverlappedBBs::hex(address)
+        << "] = " << FixOverlappedBBs::hex(value));
+    return true;
+}
@@ -0,0 +1,81 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CONSTANT_MEMORY_H__
+#define __CONSTANT_MEMORY_H__ 1
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Read-only view of the memory images given with -memory and -memory-ro
+ * (path-to-file@0xL0ADADD7). Images given with -memory-ro are also
+ * read-only in the firmware itself, loads from them can be folded no
+ * matter what ran before.
+ *
+ * Every image is mapped with mmap and the segments are kept sorted by
+ * their load address, so an address is resolved with a binary search
+ * and a load is a single memcpy (byte swapped if the target endianness
+ * differs from the host one).
+ */
+class ConstantMemory {
+public:
+    struct Segment {
+        uint64_t start;
+        uint64_t end;
+        const uint8_t *data;
+        size_t mapLen;
+        std::string path;
+        bool readOnly;
+    };
+
+    explicit ConstantMemory(bool isBigEndian);
+    ~ConstantMemory();
+
+    /* memory described by -memory, -memory-ro and -is-big-endian */
+    static ConstantMemory *fromCommandLine();
+
+    /* path-to-file@0xL0ADADD7 */
+    bool addPool(const std::string &desc, bool readOnly = false);
+    bool addPool(const std::string &path, uint64_t start,
+            bool readOnly = false);
+
+    bool contains(uint64_t address, unsigned byteCnt) const;
+    /* byteCnt is one of 1, 2, 4, 8; false if not fully inside a segment
+     * (or inside a writable one and onlyReadOnly is set)
+     */
+    bool read(uint64_t address, unsigned byteCnt, uint64_t &value,
+            bool onlyReadOnly = false) const;
+
+    size_t size() const { return m_segments.size(); }
+    bool isBigEndian() const { return m_isBigEndian; }
+
+private:
+    ConstantMemory(const ConstantMemory &);
+    ConstantMemory &operator=(const ConstantMemory &);
+
+    const Segment *find(uint64_t address, unsigned byteCnt) const;
+
+    std::vector<Segment> m_segments;
+    bool m_isBigEndian;
+    bool m_swap;
+};
+
+#endif
@@ -0,0 +1,208 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DeadFlagElimination.h"
+#include "PassUtils.h"
+
+#include <llvm/IntrinsicInst.h>
+#include <llvm/Support/CFG.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+char DeadFlagElimination::ID = 0;
+static RegisterPass<DeadFlagElimination> X("dead-flags",
+        "Remove stores to the ARM flags that are never read", false, false);
+
+static cl::opt<bool> FlagsDeadAtExit("flags-dead-at-exit",
+        cl::desc("Consider the flags dead when a function returns"),
+        cl::init(false));
+
+static const char *flagNames[] = {"NF", "ZF", "CF", "VF"};
+
+bool
+DeadFlagElimination::doInitialization(Module &M)
+{
+    m_escaped = 0;
+    for (unsigned i = 0; i < FlagCnt; ++i) {
+        m_flags[i] = M.getNamedGlobal(flagNames[i]);
+        if (!m_flags[i])
+            continue;
+        for (Value::use_iterator ui = m_flags[i]->use_begin(),
+                ue = m_flags[i]->use_end(); ui != ue; ++ui) {
+            if (LoadInst *load = dyn_cast<LoadInst>(*ui)) {
+                if (!load->isVolatile())
+                    continue;
+            } else if (StoreInst *store = dyn_cast<StoreInst>(*ui)) {
+                if (!store->isVolatile() &&
+                        store->getPointerOperand() == m_flags[i])
+                    continue;
+            }
+            m_escaped |= 1 << i;
+            break;
+        }
+    }
+    return false;
+}
+
+DeadFlagElimination::FlagMask
+DeadFlagElimination::getFlag(Value *ptr) const
+{
+    for (unsigned i = 0; i < FlagCnt; ++i) {
+        if (m_flags[i] && ptr == m_flags[i])
+            return 1 << i;
+    }
+    return 0;
+}
+
+static bool mayReadFlags(CallInst *call)
+{
+    if (isa<IntrinsicInst>(call) || call->doesNotAccessMemory())
+        return false;
+
+    /* the softmmu helpers only touch guest memory */
+    Function *callee = call->getCalledFunction();
+    if (callee && callee->getName().endswith("_mmu") &&
+            (callee->getName().startswith("__ld") ||
+             callee->getName().startswith("__st")))
+        return false;
+
+    return true;
+}
+
+/* backward transfer of the live flags over one instruction */
+DeadFlagElimination::FlagMask
+DeadFlagElimination::transfer(Instruction *ins, FlagMask live,
+        StoreInst **deadStore) const
+{
+    if (LoadInst *load = dyn_cast<LoadInst>(ins))
+        return live | getFlag(load->getPointerOperand());
+
+    if (StoreInst *store = dyn_cast<StoreInst>(ins)) {
+        FlagMask flag = getFlag(store->getPointerOperand());
+        if (!flag)
+            return live;
+        if (!(live & flag) && !(m_escaped & flag) && !store->isVolatile())
+            *deadStore = store;
+        return live & ~flag;
+    }
+
+    if (CallInst *call = dyn_cast<CallInst>(ins)) {
+        if (mayReadFlags(call))
+            return live | AllFlags;
+    }
+
+    return live;
+}
+
+DeadFlagElimination::FlagMask
+DeadFlagElimination::exitLiveness(BasicBlock *bb) const
+{
+    if (isa<UnreachableInst>(bb->getTerminator()))
+        return 0;
+    return FlagsDeadAtExit ? 0 : AllFlags;
+}
+
+void
+DeadFlagElimination::summarize(BasicBlock *bb, BlockFlags &flags)
+{
+    flags.use = 0;
+    flags.def = 0;
+    for (BasicBlock::iterator insi = bb->begin(), inse = bb->end();
+            insi != inse;
+            ++insi) {
+        if (LoadInst *load = dyn_cast<LoadInst>(insi)) {
+            flags.use |= getFlag(load->getPointerOperand()) & ~flags.def;
+        } else if (StoreInst *store = dyn_cast<StoreInst>(insi)) {
+            flags.def |= getFlag(store->getPointerOperand());
+        } else if (CallInst *call = dyn_cast<CallInst>(insi)) {
+            if (mayReadFlags(call))
+                flags.use |= AllFlags & ~flags.def;
+        }
+    }
+    flags.liveIn = flags.use;
+    flags.liveOut = 0;
+    flags.queued = true;
+}
+
+bool
+DeadFlagElimination::runOnFunction(Function &F)
+{
+    if (!m_flags[0] && !m_flags[1] && !m_flags[2] && !m_flags[3])
+        return false;
+
+    std::vector<BasicBlock *> worklist;
+    m_blocks.clear();
+    for (Function::iterator bbi = F.begin(), bbe = F.end(); bbi != bbe; ++bbi) {
+        summarize(bbi, m_blocks[bbi]);
+        worklist.push_back(bbi);
+    }
+
+    /* backward data flow, blocks come off the worklist in reverse
+     * layout order first */
+    while (!worklist.empty()) {
+        BasicBlock *bb = worklist.back();
+        worklist.pop_back();
+        BlockFlags &flags = m_blocks[bb];
+        flags.queued = false;
+
+        FlagMask out = 0;
+        succ_iterator si = succ_begin(bb), se = succ_end(bb);
+        if (si == se)
+            out = exitLiveness(bb);
+        for (; si != se; ++si)
+            out |= m_blocks[*si].liveIn;
+
+        FlagMask in = flags.use | (out & ~flags.def);
+        flags.liveOut = out;
+        if (in == flags.liveIn)
+            continue;
+        flags.liveIn = in;
+
+        for (pred_iterator pi = pred_begin(bb), pe = pred_end(bb); pi != pe; ++pi) {
+            BlockFlags &pred = m_blocks[*pi];
+            if (!pred.queued) {
+                pred.queued = true;
+                worklist.push_back(*pi);
+            }
+        }
+    }
+
+    std::vector<StoreInst *> deadStores;
+    for (Function::iterator bbi = F.begin(), bbe = F.end(); bbi != bbe; ++bbi) {
+        FlagMask live = m_blocks[bbi].liveOut;
+        for (BasicBlock::iterator insi = bbi->end(), insb = bbi->begin();
+                insi != insb;) {
+            --insi;
+            StoreInst *deadStore = NULL;
+            live = transfer(insi, live, &deadStore);
+            if (deadStore)
+                deadStores.push_back(deadStore);
+        }
+    }
+
+    for (std::vector<StoreInst *>::iterator si = deadStores.begin(),
+            se = deadStores.end(); si != se; ++si)
+        (*si)->eraseFromParent();
+
+    DBG("[DeadFlagElimination] " << F.getName() << ": removed " <<
+            deadStores.size() << " flag stores");
+
+    return !deadStores.empty();
+}
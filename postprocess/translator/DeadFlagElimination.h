@@ -0,0 +1,76 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DEAD_FLAG_ELIMINATION_H__
+#define __DEAD_FLAG_ELIMINATION_H__ 1
+
+#include <llvm/Pass.h>
+#include <llvm/Function.h>
+#include <llvm/Module.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/Instructions.h>
+#include <llvm/ADT/DenseMap.h>
+
+#include <vector>
+
+/*
+ * Remove the stores to the ARM condition flags (NF, ZF, CF, VF) that
+ * are overwritten on every path before being read. The liveness of the
+ * four flags is computed over the CFG of each built function as a 4 bit
+ * mask per block, so dead flags are found across the lifted blocks and
+ * not only inside one of them (which -dse already does).
+ *
+ * Calls (other than the softmmu helpers) may read every flag. At the
+ * function exit the flags are live, unless -flags-dead-at-exit is given.
+ * Run -dce afterwards to drop the computations feeding the stores.
+ */
+struct DeadFlagElimination: public llvm::FunctionPass {
+    static char ID;
+
+    DeadFlagElimination() : llvm::FunctionPass(ID) {}
+
+    virtual bool doInitialization(llvm::Module &M);
+    virtual bool runOnFunction(llvm::Function &F);
+private:
+    typedef unsigned FlagMask;
+    static const unsigned FlagCnt = 4;
+    static const FlagMask AllFlags = (1 << FlagCnt) - 1;
+
+    struct BlockFlags {
+        /* read before written in the block */
+        FlagMask use;
+        /* written in the block */
+        FlagMask def;
+        FlagMask liveIn;
+        FlagMask liveOut;
+        bool queued;
+    };
+
+    llvm::GlobalVariable *m_flags[FlagCnt];
+    /* flags used other than by plain loads and stores, never removed */
+    FlagMask m_escaped;
+    llvm::DenseMap<llvm::BasicBlock *, BlockFlags> m_blocks;
+
+    FlagMask getFlag(llvm::Value *ptr) const;
+    FlagMask transfer(llvm::Instruction *ins, FlagMask live,
+            llvm::StoreInst **deadStore) const;
+    FlagMask exitLiveness(llvm::BasicBlock *bb) const;
+    void summarize(llvm::BasicBlock *bb, BlockFlags &flags);
+};
+
+#endif
@@ -35,9 +35,11 @@
 #include <llvm/ADT/DepthFirstIterator.h>
 #include <llvm/ADT/GraphTraits.h>
 
+#include <algorithm>
 #include <list>
 #include <map>
 #include <string>
+#include <vector>
 #include <cstdint>
 
 using namespace llvm;
@@ -46,52 +48,64 @@ char FixOverlappedBBs::ID = 0;
 static RegisterPass<FixOverlappedBBs> X("fixoverlappedbbs",
         "Fix overlapped basic blocks", false, false);
 
-bool
-FixOverlappedBBs::myCompareStartOfFunc(llvm::Function *a, llvm::Function *b)
+void
+FixOverlappedBBs::getAnalysisUsage(AnalysisUsage &AU) const
 {
-    uint64_t pcA = getPCStartOfFunc(a);
-    uint64_t pcB = getPCStartOfFunc(b);
+    AU.addRequired<PCIndex>();
+    AU.addPreserved<PCIndex>();
+}
 
-    return pcA < pcB;
+void
+FixOverlappedBBs::buildInsIndex(llvm::Function *func, InsIndex &index)
+{
+    index.clear();
+    for (auto bbi = func->begin(), bbe = func->end();
+            bbi != bbe;
+            ++bbi) {
+        for (auto insi = bbi->begin(), inse = bbi->end();
+                insi != inse;
+                ++insi) {
+            if (!insi->getMetadata("INS_currPC"))
+                continue;
+            index.push_back(std::make_pair(getCurrentPCOfIns(insi),
+                        (Instruction *)insi));
+        }
+    }
+    /* stable: the first instruction (in program order) of a PC stays
+     * first
+     */
+    std::stable_sort(index.begin(), index.end(), insIndexLess);
+}
+
+bool
+FixOverlappedBBs::insIndexLess(const InsIndex::value_type &a,
+        const InsIndex::value_type &b)
+{
+    return a.first < b.first;
 }
 
 void
 FixOverlappedBBs::truncateFuncAndLinkWith(llvm::Function *a, llvm::Function *b)
 {
-    uint64_t pcA = getPCStartOfFunc(a);
-    uint64_t pcB = getPCStartOfFunc(b);
+    uint64_t pcA = m_index->getPCStart(a);
+    uint64_t pcB = m_index->getPCStart(b);
+    uint64_t prevPc = pcA;
     assert(pcA < pcB);
-    std::list<BasicBlock *> eraseBBs;
-    std::list<Instruction *> eraseInsns;
-    bool found = false;
 
-    Function::iterator deleteAfterBB, overlapBB;
-    BasicBlock::iterator deleteAfterIns;
-    bool hasPrev = false;
+    buildInsIndex(a, m_insIndex);
 
     /* align */
-    for (auto bbi = a->begin(), bbe = a->end();
-            !found && bbi != bbe;
-            ++bbi) {
-        hasPrev = false;
-        for (auto insi = bbi->begin(), inse = bbi->end();
-                !found && insi != inse;
-                ++insi) {
-            uint64_t pc = getCurrentPCOfIns(insi);
-            if (pc == pcB) {
-                /* found the allignment */
-                outs() << "[FixOverlappedBBs] bb " << a->getName() << " and " <<
-                    b->getName() << " are aligned at " << hex(pc) << "\n";
-                    //<< ": " << *insi << "\n";
-                found = true;
-                deleteAfterBB = bbi;
-                deleteAfterIns = insi;
-            }
-        }
-    }
-    assert(found);
-    overlapBB = deleteAfterBB;
+    auto pos = std::lower_bound(m_insIndex.begin(), m_insIndex.end(),
+            std::make_pair(pcB, (Instruction *)NULL), insIndexLess);
+    assert(pos != m_insIndex.end() && pos->first == pcB);
+    if (pos != m_insIndex.begin())
+        prevPc = (pos-1)->first;
+
+    outs() << "[FixOverlappedBBs] bb " << a->getName() << " and " <<
+        b->getName() << " are aligned at " << hex(pcB) << "\n";
 
+    BasicBlock *overlapBB = pos->second->getParent();
+    BasicBlock::iterator deleteAfterIns = pos->second;
     ++deleteAfterIns;
 
     BasicBlock *deadTail = overlapBB->splitBasicBlock(deleteAfterIns);
@@ -101,6 +115,7 @@ FixOverlappedBBs::truncateFuncAndLinkWith(llvm::Function *a, llvm::Function *b)
     linkWith(a, overlapBB, pcB);
 
     DeleteDeadBlock(deadTail);
+    m_index->setLastPc(a, prevPc);
 }
 
 void
@@ -129,66 +144,68 @@ FixOverlappedBBs::linkWith(llvm::Function *srcFunc, llvm::BasicBlock
             std::string("-split-to-")+hex(target));
 }
 
+bool
+FixOverlappedBBs::blockRangeLess(const BlockRange &a, const BlockRange &b)
+{
+    if (a.lastPc != b.lastPc)
+        return a.lastPc < b.lastPc;
+    return a.pcStart < b.pcStart;
+}
+
 bool
 FixOverlappedBBs::runOnModule(Module &M)
 {
-    std::map<uint64_t, std::list<Function *> > endings;
-    std::list<uint64_t> overlaps;
-
-    /* find the overlaps */
-    for (auto ifunc = M.begin(), ifunce = M.end();
-            ifunc != ifunce;
-            ++ifunc) {
-        /* TODO: find another way to skip uninteresting functions */
-        if (!std::strstr(ifunc->getName().data(), "void-tcg-llvm-tb"))
-            continue;
-
-        //uint64_t pcEnd = getPCEndOfFunc(ifunc);
-        unsigned pcEnd = getLastPc(&ifunc->getEntryBlock());
-        endings[pcEnd].push_back(ifunc);
-        if (endings[pcEnd].size() == 2) {
-            overlaps.push_back(pcEnd);
-        }
+    std::vector<BlockRange> ranges;
+    unsigned overlaps = 0;
+
+    m_index = &getAnalysis<PCIndex>();
+
+    ranges.reserve(m_index->size());
+    for (auto ii = m_index->begin(), iie = m_index->end();
+            ii != iie;
+            ++ii) {
+        BlockRange r;
+        r.func = ii->second;
+        r.pcStart = ii->first;
+        r.lastPc = m_index->getLastPc(r.func);
+        assert(r.lastPc && "expected lastpc in metadata node");
+        ranges.push_back(r);
     }
 
-    /* sort functions by the PC of the first instruction.
-     * We need this for truncateFuncAndLinkWith
+    /* blocks ending at the same instruction are adjacent, ordered by
+     * their start
      */
-    for (auto o = overlaps.begin(), oe = overlaps.end();
-            o != oe;
-            ++o) {
-        auto &funcList = endings[*o];
-        int cnt = funcList.size();
-        assert(cnt >= 2);
-        funcList.sort(myCompareStartOfFunc);
-        if (cnt >= 3) {
-            outs() << "[FixOverlappedBBs] found more the twice (" << cnt << ") the overlap " << hex(*o) << "\n";
-            ///for (auto funci = endings[*o].begin(), funcie = endings[*o].end();
-            ///        funci != funcie;
-            ///        ++funci) {
-            ///    outs() << "[FixOverlappedBBs] F " << **funci << "\n";
-            ///}
-        }
-    }
+    std::sort(ranges.begin(), ranges.end(), blockRangeLess);
 
-    for (auto o = overlaps.begin(), oe = overlaps.end();
-            o != oe;
-            ++o) {
-        auto funcList = endings[*o];
-        int cnt = funcList.size();
-        assert(cnt >= 2);
-        auto curr = funcList.begin();
-        auto next = funcList.begin();
-        auto end = funcList.end();
-        ++next;
-        do {
-            truncateFuncAndLinkWith(*curr, *next);
-            ++curr;
-            ++next;
-        } while (next != end);
+    /* a chain a0 < a1 < ... < an of blocks with the same last
+     * instruction: a0 is cut at a1, a1 at a2, ...
+     */
+    for (size_t first = 0, cnt = ranges.size(); first < cnt;) {
+        size_t last = first;
+        while (last + 1 < cnt && ranges[last + 1].lastPc == ranges[first].lastPc)
+            ++last;
+
+        if (last - first + 1 >= 3) {
+            outs() << "[FixOverlappedBBs] found more the twice (" <<
+                last - first + 1 << ") the overlap " <<
+                hex(ranges[first].lastPc) << "\n";
+        }
+        for (size_t i = first; i < last; ++i) {
+            /* copies of a block (same start) are all cut at the next
+             * block that starts later */
+            size_t next = i + 1;
+            while (next <= last && ranges[next].pcStart == ranges[i].pcStart)
+                ++next;
+            if (next <= last)
+                truncateFuncAndLinkWith(ranges[i].func, ranges[next].func);
+        }
+        if (last > first)
+            ++overlaps;
+        first = last + 1;
     }
+    m_insIndex.clear();
 
-    return (overlaps.size() > 0);
+    return (overlaps > 0);
 }
 
 uint64_t
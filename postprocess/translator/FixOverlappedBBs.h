@@ -27,8 +27,12 @@
 #include <llvm/Constants.h>
 
 #include <string>
+#include <utility>
+#include <vector>
 #include <cstdint>
 
+#include "PCIndex.h"
+
 /*
  * basic blocks can overlap.
  * This pass will fix any overlapping basic blocks by splitting the
@@ -38,6 +42,11 @@
  * This module works with the assumption that the basic blocks will pe
  * overlapp at the ending instructions.
  *
+ * The blocks are sorted by (last PC, start PC), so every chain of
+ * blocks sharing the last instruction is a run of the array. Each block
+ * of a chain is cut at the start of the next one, the cut is found by a
+ * binary search over the PCs of its instructions.
+ *
  */
 struct FixOverlappedBBs: public llvm::ModulePass {
     static char ID;
@@ -45,6 +54,7 @@ struct FixOverlappedBBs: public llvm::ModulePass {
     FixOverlappedBBs() : llvm::ModulePass(ID) {}
 
     virtual bool runOnModule(llvm::Module &f);
+    virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
     static uint64_t getPCEndOfFunc(llvm::Function *func);
     static uint64_t getPCStartOfFunc(llvm::Function *func);
     static uint64_t getCurrentPCOfIns(llvm::Instruction *ins);
@@ -57,11 +67,26 @@ struct FixOverlappedBBs: public llvm::ModulePass {
             llvm::Instruction *ins,
             std::string metadataName);
 private:
+    struct BlockRange {
+        uint64_t lastPc;
+        uint64_t pcStart;
+        llvm::Function *func;
+    };
+    /* (INS_currPC, instruction), sorted by PC */
+    typedef std::vector<std::pair<uint64_t, llvm::Instruction *> > InsIndex;
+
+    static bool blockRangeLess(const BlockRange &a, const BlockRange &b);
+    static bool insIndexLess(const InsIndex::value_type &a,
+            const InsIndex::value_type &b);
+    static void buildInsIndex(llvm::Function *func, InsIndex &index);
+
     static uint64_t getHexMetadataFromFunc(
             llvm::Function *func,
             std::string metadataName);
-    static void truncateFuncAndLinkWith(llvm::Function *a, llvm::Function *b);
+    void truncateFuncAndLinkWith(llvm::Function *a, llvm::Function *b);
     static void linkWith(llvm::Function *srcFunc, llvm::BasicBlock *srcBB, uint64_t target);
-    static bool myCompareStartOfFunc(llvm::Function *a, llvm::Function *b);
+
+    PCIndex *m_index;
+    InsIndex m_insIndex;
 };
 #endif
@@ -18,6 +18,7 @@
 
 #include "InternalizeGlobals.h"
 #include "PassUtils.h"
+#include "PCIndex.h"
 
 using namespace llvm;
 
@@ -25,6 +26,11 @@ char InternalizeGlobals::ID = 0;
 static RegisterPass<InternalizeGlobals> X("internalize-globals",
         "S2E Internalize and zero-initialize global variables", false, false);
 
+void InternalizeGlobals::getAnalysisUsage(AnalysisUsage &AU) const {
+    /* only linkage and initializers change, the blocks stay put */
+    AU.addPreserved<PCIndex>();
+}
+
 bool InternalizeGlobals::runOnModule(Module &m) {
     foreach2(g, m.global_begin(), m.global_end()) {
         if (g->hasInitializer()) {
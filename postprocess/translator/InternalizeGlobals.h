@@ -28,6 +28,7 @@ struct InternalizeGlobals : public ModulePass {
     InternalizeGlobals() : ModulePass(ID) {}
 
     virtual bool runOnModule(Module &m);
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const;
 };
 
 #endif  // _INITIALIZE_GLOBALS_H
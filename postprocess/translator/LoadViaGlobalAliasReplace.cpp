@@ -19,68 +19,223 @@
 #include "LoadViaGlobalAliasReplace.h"
 #include "PassUtils.h"
 
+#include <llvm/ADT/DepthFirstIterator.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/Support/CFG.h>
+#include <llvm/Support/CallSite.h>
+
 using namespace llvm;
 
 char LoadAliasReplacePass::ID = 0;
 static RegisterPass<LoadAliasReplacePass> X("alias-global-bb",
         "replace load from a global with the use of store", false, false);
 
-bool LoadAliasReplacePass::runOnBasicBlock(BasicBlock &BB)
+void
+LoadAliasReplacePass::getAnalysisUsage(AnalysisUsage &AU) const
+{
+    AU.addRequired<DominatorTree>();
+    AU.setPreservesCFG();
+}
+
+bool
+LoadAliasReplacePass::clobbersGlobals(Instruction *ins)
+{
+    CallSite cs(ins);
+    if (!cs)
+        return false;
+    if (cs.doesNotAccessMemory() || cs.onlyReadsMemory())
+        return false;
+
+    /* the softmmu helpers only touch guest memory, never the register
+     * globals
+     */
+    Function *callee = cs.getCalledFunction();
+    if (callee && callee->getName().startswith("__") &&
+            callee->getName().endswith("_mmu") &&
+            (callee->getName().startswith("__ld") ||
+             callee->getName().startswith("__st")))
+        return false;
+
+    return true;
+}
+
+bool
+LoadAliasReplacePass::isLocalStore(StoreInst *storeInst)
+{
+    return isa<AllocaInst>(GetUnderlyingObject(storeInst->getPointerOperand()));
+}
+
+GlobalVariable *
+LoadAliasReplacePass::getStoredGlobal(StoreInst *storeInst)
+{
+    Value *ptr = storeInst->getPointerOperand();
+    return dyn_cast<GlobalVariable>(GetUnderlyingObject(ptr));
+}
+
+void
+LoadAliasReplacePass::summarize(BasicBlock *BB, BlockSummary &summary)
+{
+    summary.clobbers = false;
+    summary.killsAll = false;
+    for (auto insi = BB->begin(), insie = BB->end();
+            insi != insie;
+            ++insi) {
+        if (StoreInst *storeInst = dyn_cast<StoreInst>(insi)) {
+            if (isLocalStore(storeInst))
+                continue;
+            GlobalVariable *gv = getStoredGlobal(storeInst);
+            if (gv)
+                summary.stored.insert(gv);
+            else
+                summary.clobbers = true;
+        } else if (clobbersGlobals(insi)) {
+            summary.clobbers = true;
+        }
+        if (summary.clobbers)
+            return;
+    }
+}
+
+/*
+ * The globals written on the paths idom(B) -> B, for every block B. A
+ * path from idom(B) to a predecessor P of B goes down the dominator tree
+ * from idom(B) to P: between two nodes of that chain it is a path of
+ * the lower node from its own idom. So the kills of B are the stored
+ * globals and the kills of the chain nodes of its predecessors. Loops
+ * (and irreducible regions) make the kills depend on each other, the
+ * sets only grow and are updated until they are stable, usually in one
+ * or two rounds.
+ */
+void
+LoadAliasReplacePass::computeKills(DominatorTree &DT)
 {
-	std::list<Instruction *> eraseLoads;
-	std::list< std::pair<LoadInst*, StoreInst *> > aliases;
-
-	bool verbose_ = false;
-	if (BB.getParent()->getName() == "Function_0x0001beec" &&
-			BB.getName() == "entry")
-		verbose_ = true;
-#define DEBUG_a(a) if (verbose_) do { a ; } while (0)
-	//DEBUG_a(llvm::outs() << "got bb\n");
-
-	auto rit = BB.end();
-	do {
-		--rit;
-		if (rit == BB.begin())
-			break;
-		LoadInst *loadInst = dyn_cast<LoadInst>(rit);
-		if (!loadInst)
-			continue;
-
-		GlobalVariable *gvLoad = dyn_cast<GlobalVariable>(loadInst->getOperand(0));
-		if (!gvLoad)
-			continue;
-
-		//if (gvLoad->getName() == "ZF")
-		//	llvm::outs() << "LOAD: " << *loadInst << "\n";
-
-		auto rit_prev = rit;
-		do {
-			--rit_prev;
-			StoreInst *storeInst = dyn_cast<StoreInst>(rit_prev);
-			if (!storeInst)
-				continue;
-			GlobalVariable *gvStore = dyn_cast<GlobalVariable>(storeInst->getOperand(1));
-			if (!gvStore)
-				continue;
-			if (gvLoad == gvStore) {
-				DEBUG_a(llvm::outs() << "found alias: " << *storeInst << " " << *loadInst <<"\n");
-				//DEBUG_a(llvm::outs() << "QQQ:  " << *storeInst->getOperand(0) <<"\n");
-				aliases.push_back(std::make_pair(loadInst, storeInst));
-			}
-		} while (rit_prev != BB.begin());
-		assert(rit_prev != rit);
-	} while (rit != BB.begin());
-
-	for (auto a : aliases) {
-		a.first->replaceAllUsesWith(a.second->getOperand(0));
-	}
-
-	///for (auto a : aliases) {
-	///	//a.first->removeFromParent();
-	///}
-
-	if (aliases.size() > 0)
-		return true;
-	return false;
+    std::vector<DomTreeNode *> order;
+    for (df_iterator<DomTreeNode *> ni = df_begin(DT.getRootNode()),
+            ne = df_end(DT.getRootNode());
+            ni != ne;
+            ++ni)
+        order.push_back(*ni);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        /* the children first, the back edges come from there */
+        for (auto ni = order.rbegin(), ne = order.rend(); ni != ne; ++ni) {
+            if (!(*ni)->getIDom())
+                continue;
+            BasicBlock *BB = (*ni)->getBlock();
+            BasicBlock *idom = (*ni)->getIDom()->getBlock();
+            BlockSummary &summary = m_summaries[BB];
+            if (summary.killsAll)
+                continue;
+            unsigned before = summary.killed.size();
+
+            foreach_pred(BB, pred, {
+                for (DomTreeNode *x = DT.getNode(pred);
+                        x && x->getBlock() != idom && !summary.killsAll;
+                        x = x->getIDom()) {
+                    BlockSummary &chain = m_summaries[x->getBlock()];
+                    summary.killsAll |= chain.clobbers;
+                    summary.killed.insert(chain.stored.begin(),
+                            chain.stored.end());
+                    if (x == *ni)
+                        continue;
+                    summary.killsAll |= chain.killsAll;
+                    summary.killed.insert(chain.killed.begin(),
+                            chain.killed.end());
+                }
+            });
+            changed |= summary.killsAll || summary.killed.size() != before;
+        }
+    }
+}
+
+void
+LoadAliasReplacePass::getEntryTable(BasicBlock *BB, DominatorTree &DT,
+        ValueTable &table)
+{
+    DomTreeNode *node = DT.getNode(BB);
+    if (!node || !node->getIDom())
+        return;
+    BlockSummary &summary = m_summaries[BB];
+    if (summary.killsAll)
+        return;
+
+    ValueTable &idomTable = m_exitTables[node->getIDom()->getBlock()];
+    for (auto ti = idomTable.begin(), te = idomTable.end();
+            ti != te;
+            ++ti) {
+        if (!summary.killed.count(ti->first))
+            table.insert(*ti);
+    }
 }
 
+bool
+LoadAliasReplacePass::runOnFunction(Function &F)
+{
+    DominatorTree &DT = getAnalysis<DominatorTree>();
+    unsigned replaced = 0;
+
+    m_summaries.clear();
+    m_exitTables.clear();
+    for (auto bbi = F.begin(), bbie = F.end();
+            bbi != bbie;
+            ++bbi) {
+        summarize(bbi, m_summaries[bbi]);
+    }
+    computeKills(DT);
+
+    /* pre-order: the idom of a block is always done before the block */
+    for (df_iterator<DomTreeNode *> ni = df_begin(DT.getRootNode()),
+            ne = df_end(DT.getRootNode());
+            ni != ne;
+            ++ni) {
+        BasicBlock *BB = ni->getBlock();
+        ValueTable table;
+        getEntryTable(BB, DT, table);
+
+        for (auto insi = BB->begin(), insie = BB->end();
+                insi != insie;) {
+            Instruction *ins = insi++;
+
+            if (LoadInst *loadInst = dyn_cast<LoadInst>(ins)) {
+                GlobalVariable *gv =
+                    dyn_cast<GlobalVariable>(loadInst->getPointerOperand());
+                if (!gv || loadInst->isVolatile())
+                    continue;
+                auto known = table.find(gv);
+                if (known != table.end() &&
+                        known->second->getType() == loadInst->getType()) {
+                    loadInst->replaceAllUsesWith(known->second);
+                    loadInst->eraseFromParent();
+                    ++replaced;
+                    continue;
+                }
+                table[gv] = loadInst;
+            } else if (StoreInst *storeInst = dyn_cast<StoreInst>(ins)) {
+                if (isLocalStore(storeInst))
+                    continue;
+                GlobalVariable *gv = getStoredGlobal(storeInst);
+                if (!gv) {
+                    table.clear();
+                } else if (gv == storeInst->getPointerOperand() &&
+                        !storeInst->isVolatile()) {
+                    table[gv] = storeInst->getValueOperand();
+                } else {
+                    table.erase(gv);
+                }
+            } else if (clobbersGlobals(ins)) {
+                table.clear();
+            }
+        }
+        m_exitTables[BB].swap(table);
+    }
+
+    DBG("[LoadAliasReplacePass] " << F.getName() << ": replaced " <<
+            replaced << " loads");
+
+    m_summaries.clear();
+    m_exitTables.clear();
+    return replaced > 0;
+}
@@ -20,23 +20,55 @@
 #define __LOAD_VIA_GLOBAL_ALIAS_REPLACE_H__ 1
 
 #include "llvm/Pass.h"
-#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/Analysis/Dominators.h>
 #include <llvm/Function.h>
+#include <llvm/GlobalVariable.h>
 #include <llvm/Instructions.h>
 #include <llvm/Module.h>
 #include <llvm/Support/raw_ostream.h>
-#include <llvm/Transforms/Scalar.h>
-#include <llvm/Transforms/Utils/Cloning.h>
-#include <llvm/Transforms/Utils/ValueMapper.h>
-#include <llvm/Transforms/Utils/BasicBlockUtils.h>
 
 using namespace llvm;
 
-struct LoadAliasReplacePass: public BasicBlockPass {
+/*
+ * Forward the value of the last store to a global (or of the last load
+ * from it) to the following loads of the same global.
+ *
+ * Every block is walked once, in dominator tree order, with a table of
+ * the last known value of each global. A block starts from the table at
+ * the end of its immediate dominator, minus the globals that may be
+ * written on a path between the two. Those are computed for all the
+ * blocks at once, from the dominator tree. Calls that may write memory and
+ * stores through pointers that are neither a known global nor a local
+ * alloca clear the table.
+ */
+struct LoadAliasReplacePass: public FunctionPass {
     static char ID;
-    LoadAliasReplacePass() : BasicBlockPass(ID) {}
+    LoadAliasReplacePass() : FunctionPass(ID) {}
+
+    virtual bool runOnFunction(Function &F);
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const;
+
+private:
+    typedef DenseMap<GlobalVariable *, Value *> ValueTable;
+    struct BlockSummary {
+        SmallPtrSet<GlobalVariable *, 8> stored;
+        bool clobbers;
+        /* written on a path from the idom, or anything if killsAll */
+        SmallPtrSet<GlobalVariable *, 8> killed;
+        bool killsAll;
+    };
+
+    static bool clobbersGlobals(Instruction *ins);
+    static bool isLocalStore(StoreInst *storeInst);
+    static GlobalVariable *getStoredGlobal(StoreInst *storeInst);
+    void summarize(BasicBlock *BB, BlockSummary &summary);
+    void computeKills(DominatorTree &DT);
+    void getEntryTable(BasicBlock *BB, DominatorTree &DT, ValueTable &table);
 
-    virtual bool runOnBasicBlock(BasicBlock &m);
+    DenseMap<BasicBlock *, BlockSummary> m_summaries;
+    DenseMap<BasicBlock *, ValueTable> m_exitTables;
 };
 
 #endif
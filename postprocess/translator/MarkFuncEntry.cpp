@@ -18,6 +18,7 @@
 
 #include "MarkFuncEntry.h"
 #include "FixOverlappedBBs.h"
+#include "PCIndex.h"
 
 #include <llvm/Bitcode/ReaderWriter.h>
 #include <llvm/Function.h>
@@ -38,15 +39,20 @@ char MarkFuncEntry::ID = 0;
 static RegisterPass<MarkFuncEntry> X("markfuncentry",
         "Rename the entry basic block to function_entry", false, false);
 
+void
+MarkFuncEntry::getAnalysisUsage(AnalysisUsage &AU) const
+{
+    AU.addRequired<PCIndex>();
+    AU.addPreserved<PCIndex>();
+}
+
 bool
 MarkFuncEntry::runOnModule(llvm::Module &M)
 {
-    std::list<BasicBlock *> funcEntryBBs;
     std::map<uint64_t, bool> directCallTargets;
     bool modified = false;
-    bool thisBBisEntry = false;
+    PCIndex &index = getAnalysis<PCIndex>();
 
-    uint64_t pcStart;
     for (auto funci = M.begin(), funcie = M.end();
             funci != funcie;
             ++funci) {
@@ -66,18 +72,15 @@ MarkFuncEntry::runOnModule(llvm::Module &M)
         }
     }
 
-    for (auto funci = M.begin(), funcie = M.end();
-            funci != funcie;
-            ++funci) {
-        /* TODO: find another way to skip uninteresting functions */
-        if (!std::strstr(funci->getName().data(), "void-tcg-llvm-tb"))
-            continue;
-        assert(funci->size());
-        BasicBlock &b = funci->front();
-        pcStart = FixOverlappedBBs::getPCStartOfFunc(funci);
-        if (directCallTargets.find(pcStart) != directCallTargets.end()) {
-            outs() << "[MarkFuncEntry] mark " << funci->getName() << "\n";
-            b.setName("func_entry_point");
+    for (auto ti = directCallTargets.begin(), tie = directCallTargets.end();
+            ti != tie;
+            ++ti) {
+        PCIndex::StartRange blocks = index.lookupAll(ti->first);
+        for (auto bi = blocks.first; bi != blocks.second; ++bi) {
+            Function *func = bi->second;
+            outs() << "[MarkFuncEntry] mark " << func->getName() << "\n";
+            func->front().setName("func_entry_point");
+            index.setEntry(func, true);
             modified = true;
         }
     }
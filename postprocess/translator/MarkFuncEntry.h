@@ -39,6 +39,7 @@ struct MarkFuncEntry: public llvm::ModulePass {
     MarkFuncEntry() : llvm::ModulePass(ID) {}
 
     virtual bool runOnModule(llvm::Module &M);
+    virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
 };
 
 #endif
@@ -0,0 +1,190 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PCIndex.h"
+#include "FixOverlappedBBs.h"
+#include "PassUtils.h"
+
+#include <llvm/Function.h>
+#include <llvm/Instructions.h>
+#include <llvm/Metadata.h>
+#include <llvm/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstring>
+#include <map>
+
+using namespace llvm;
+
+char PCIndex::ID = 0;
+static RegisterPass<PCIndex> X("pcindex",
+        "Index the translated basic blocks by PC", false, true);
+
+void
+PCIndex::getAnalysisUsage(AnalysisUsage &AU) const
+{
+    AU.setPreservesAll();
+}
+
+bool
+PCIndex::runOnModule(Module &M)
+{
+    rebuild(M);
+    DBG("[PCIndex] indexed " << m_byStart.size() << " blocks");
+    return false;
+}
+
+void
+PCIndex::rebuild(Module &M)
+{
+    m_byStart.clear();
+    m_byFunc.clear();
+    for (auto funci = M.begin(), funcie = M.end();
+            funci != funcie;
+            ++funci) {
+        insert(funci);
+    }
+}
+
+bool
+PCIndex::isTcgBlock(Function *func)
+{
+    if (!std::strstr(func->getName().data(), "void-tcg-llvm-tb"))
+        return false;
+    if (func->empty() || func->getEntryBlock().empty())
+        return false;
+    return func->getEntryBlock().front().getMetadata("BB_pcStart");
+}
+
+bool
+PCIndex::insert(Function *func)
+{
+    if (!isTcgBlock(func))
+        return false;
+
+    BasicBlock &entry = func->getEntryBlock();
+    Instruction *first = &entry.front();
+    BlockInfo info;
+
+    info.pcStart = FixOverlappedBBs::getHexMetadataFromIns(first,
+            "BB_pcStart");
+    info.pcEnd = 0;
+    if (first->getMetadata("BB_pcEnd"))
+        info.pcEnd = FixOverlappedBBs::getHexMetadataFromIns(first,
+                "BB_pcEnd");
+    info.lastPc = 0;
+    if (entry.getTerminator()) {
+        MDNode *md = entry.getTerminator()->getMetadata("lastpc");
+        if (md)
+            info.lastPc = cast<ConstantInt>(md->getOperand(0))->getZExtValue();
+    }
+    info.isEntry = entry.getName() == "func_entry_point";
+
+    insert(func, info);
+    return true;
+}
+
+void
+PCIndex::insert(Function *func, const BlockInfo &info)
+{
+    if (m_byFunc.count(func))
+        erase(func);
+    m_byFunc[func] = info;
+    m_byStart.insert(std::make_pair(info.pcStart, func));
+}
+
+void
+PCIndex::erase(Function *func)
+{
+    auto it = m_byFunc.find(func);
+    if (it == m_byFunc.end())
+        return;
+    uint64_t pcStart = it->second.pcStart;
+    m_byFunc.erase(it);
+
+    /* only the blocks starting at the same PC (rarely more than one) */
+    for (auto si = m_byStart.lower_bound(pcStart),
+            sie = m_byStart.upper_bound(pcStart);
+            si != sie;
+            ++si) {
+        if (si->second == func) {
+            m_byStart.erase(si);
+            return;
+        }
+    }
+}
+
+Function *
+PCIndex::lookup(uint64_t pcStart) const
+{
+    /* the last one, as the blocks used to overwrite each other */
+    auto it = m_byStart.upper_bound(pcStart);
+    if (it == m_byStart.begin())
+        return NULL;
+    --it;
+    if (it->first != pcStart)
+        return NULL;
+    return it->second;
+}
+
+PCIndex::StartRange
+PCIndex::lookupAll(uint64_t pcStart) const
+{
+    return m_byStart.equal_range(pcStart);
+}
+
+const PCIndex::BlockInfo *
+PCIndex::getInfo(Function *func) const
+{
+    auto it = m_byFunc.find(func);
+    if (it == m_byFunc.end())
+        return NULL;
+    return &it->second;
+}
+
+uint64_t
+PCIndex::getPCStart(Function *func) const
+{
+    const BlockInfo *info = getInfo(func);
+    assert(info && "block not indexed");
+    return info->pcStart;
+}
+
+uint64_t
+PCIndex::getLastPc(Function *func) const
+{
+    const BlockInfo *info = getInfo(func);
+    assert(info && "block not indexed");
+    return info->lastPc;
+}
+
+void
+PCIndex::setLastPc(Function *func, uint64_t lastPc)
+{
+    auto it = m_byFunc.find(func);
+    assert(it != m_byFunc.end() && "block not indexed");
+    it->second.lastPc = lastPc;
+}
+
+void
+PCIndex::setEntry(Function *func, bool isEntry)
+{
+    auto it = m_byFunc.find(func);
+    assert(it != m_byFunc.end() && "block not indexed");
+    it->second.isEntry = isEntry;
+}
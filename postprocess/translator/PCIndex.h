@@ -0,0 +1,93 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PC_INDEX_H__
+#define __PC_INDEX_H__ 1
+
+#include <llvm/Pass.h>
+#include <llvm/Function.h>
+#include <llvm/Module.h>
+
+#include <map>
+#include <cstdint>
+
+/*
+ * This analysis maps the start PC of every translated basic block
+ * (represented by a void-tcg-llvm-tb function) to its function. The
+ * metadata of a block (BB_pcStart, BB_pcEnd, lastpc and the
+ * func_entry_point mark) is parsed once, when the block is added to the
+ * index.
+ *
+ * Passes that modify the blocks should declare the index as preserved
+ * and keep it up to date with insert, erase, setLastPc and setEntry.
+ * The LLVM passes run in between (-dce, -gvn) do not preserve it, so
+ * the pass manager indexes the module again after them.
+ *
+ * If two blocks start at the same PC, the last one (in module order)
+ * is returned by lookup, the one BuildFunctions has always inlined.
+ * lookupAll and the iteration (by start PC) see all of them.
+ */
+struct PCIndex : public llvm::ModulePass {
+    struct BlockInfo {
+        uint64_t pcStart;
+        uint64_t pcEnd;
+        /* PC of the last instruction, 0 if unknown */
+        uint64_t lastPc;
+        bool isEntry;
+    };
+    /* equal PCs keep their insertion order */
+    typedef std::multimap<uint64_t, llvm::Function *> StartMap;
+    typedef std::pair<StartMap::const_iterator, StartMap::const_iterator>
+        StartRange;
+
+    static char ID;
+
+    PCIndex() : llvm::ModulePass(ID) {}
+
+    virtual bool runOnModule(llvm::Module &M);
+    virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
+
+    /* drop everything and index M, can be used without a pass manager */
+    void rebuild(llvm::Module &M);
+    static bool isTcgBlock(llvm::Function *func);
+
+    llvm::Function *lookup(uint64_t pcStart) const;
+    StartRange lookupAll(uint64_t pcStart) const;
+    const BlockInfo *getInfo(llvm::Function *func) const;
+    uint64_t getPCStart(llvm::Function *func) const;
+    uint64_t getLastPc(llvm::Function *func) const;
+
+    /* return false if func is not a tcg block */
+    bool insert(llvm::Function *func);
+    /* insert a block whose metadata is already known (e.g. not
+     * materialized yet)
+     */
+    void insert(llvm::Function *func, const BlockInfo &info);
+    void erase(llvm::Function *func);
+    void setLastPc(llvm::Function *func, uint64_t lastPc);
+    void setEntry(llvm::Function *func, bool isEntry);
+
+    StartMap::const_iterator begin() const { return m_byStart.begin(); }
+    StartMap::const_iterator end() const { return m_byStart.end(); }
+    size_t size() const { return m_byStart.size(); }
+private:
+    StartMap m_byStart;
+    std::map<llvm::Function *, BlockInfo> m_byFunc;
+};
+
+#endif
@@ -0,0 +1,184 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PromoteRegisters.h"
+#include "PassUtils.h"
+
+#include <llvm/Constants.h>
+#include <llvm/Module.h>
+#include <llvm/IntrinsicInst.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+char PromoteRegisters::ID = 0;
+static RegisterPass<PromoteRegisters> X("promote-regs",
+        "Promote register globals to allocas inside each function", false, false);
+
+bool
+PromoteRegisters::isMemoryHelper(Function *callee)
+{
+    return callee && callee->getName().endswith("_mmu") &&
+        (callee->getName().startswith("__ld") ||
+         callee->getName().startswith("__st"));
+}
+
+void
+PromoteRegisters::markUnsafe(RegMap &regs, Constant *c)
+{
+    for (unsigned i = 0, e = c->getNumOperands(); i != e; ++i) {
+        Constant *op = dyn_cast<Constant>(c->getOperand(i));
+        if (GlobalVariable *gv = dyn_cast_or_null<GlobalVariable>(op))
+            regs[gv].unsafe = true;
+        else if (op && !isa<GlobalValue>(op))
+            markUnsafe(regs, op);
+    }
+}
+
+void
+PromoteRegisters::storeBack(RegMap &regs, Instruction *before)
+{
+    for (RegMap::iterator ri = regs.begin(), re = regs.end(); ri != re; ++ri) {
+        if (ri->second.unsafe || !ri->second.written)
+            continue;
+        Value *val = new LoadInst(ri->second.slot, "", before);
+        new StoreInst(val, ri->first, before);
+    }
+}
+
+void
+PromoteRegisters::reload(RegMap &regs, Instruction *before)
+{
+    for (RegMap::iterator ri = regs.begin(), re = regs.end(); ri != re; ++ri) {
+        if (ri->second.unsafe)
+            continue;
+        Value *val = new LoadInst(ri->first, "", before);
+        new StoreInst(val, ri->second.slot, before);
+    }
+}
+
+bool
+PromoteRegisters::runOnFunction(Function &F)
+{
+    RegMap regs;
+    std::vector<Instruction *> accesses;
+    std::vector<Instruction *> calls;
+    std::vector<Instruction *> returns;
+
+    for (Function::iterator bbi = F.begin(), bbe = F.end(); bbi != bbe; ++bbi) {
+        for (BasicBlock::iterator insi = bbi->begin(), inse = bbi->end();
+                insi != inse;
+                ++insi) {
+            LoadInst *load = dyn_cast<LoadInst>(insi);
+            StoreInst *store = dyn_cast<StoreInst>(insi);
+            GlobalVariable *accessed = NULL;
+
+            if (load && !load->isVolatile())
+                accessed = dyn_cast<GlobalVariable>(load->getPointerOperand());
+            else if (store && !store->isVolatile())
+                accessed = dyn_cast<GlobalVariable>(store->getPointerOperand());
+
+            if (accessed && !accessed->isConstant() &&
+                    accessed->getType()->getElementType()->isIntegerTy()) {
+                RegInfo &info = regs[accessed];
+                info.written |= store != NULL;
+                accesses.push_back(insi);
+            } else {
+                accessed = NULL;
+            }
+
+            /* any other use of a global (address taken, stored value,
+             * call argument, ...) keeps it in memory */
+            for (unsigned i = 0, e = insi->getNumOperands(); i != e; ++i) {
+                if (ConstantExpr *ce = dyn_cast<ConstantExpr>(insi->getOperand(i)))
+                    markUnsafe(regs, ce);
+                GlobalVariable *gv = dyn_cast<GlobalVariable>(insi->getOperand(i));
+                if (!gv || (gv == accessed &&
+                            i == (store ? StoreInst::getPointerOperandIndex() :
+                                LoadInst::getPointerOperandIndex())))
+                    continue;
+                regs[gv].unsafe = true;
+            }
+
+            if (isa<InvokeInst>(insi))
+                return false;
+            if (CallInst *call = dyn_cast<CallInst>(insi)) {
+                if (!isa<IntrinsicInst>(call) &&
+                        !call->doesNotAccessMemory() &&
+                        !isMemoryHelper(call->getCalledFunction()))
+                    calls.push_back(call);
+            } else if (isa<ReturnInst>(insi)) {
+                returns.push_back(insi);
+            }
+        }
+    }
+
+    unsigned promoted = 0;
+    for (RegMap::iterator ri = regs.begin(), re = regs.end(); ri != re; ++ri) {
+        if (!ri->second.unsafe)
+            ++promoted;
+    }
+    if (!promoted)
+        return false;
+
+    /* slots and live-in loads at the entry */
+    Instruction *entry = &*F.getEntryBlock().getFirstInsertionPt();
+    for (RegMap::iterator ri = regs.begin(), re = regs.end(); ri != re; ++ri) {
+        if (ri->second.unsafe)
+            continue;
+        ri->second.slot = new AllocaInst(
+                ri->first->getType()->getElementType(),
+                ri->first->getName() + ".reg", entry);
+    }
+
+    for (std::vector<Instruction *>::iterator ai = accesses.begin(),
+            ae = accesses.end(); ai != ae; ++ai) {
+        GlobalVariable *gv;
+        unsigned idx;
+        if (LoadInst *load = dyn_cast<LoadInst>(*ai)) {
+            gv = cast<GlobalVariable>(load->getPointerOperand());
+            idx = LoadInst::getPointerOperandIndex();
+        } else {
+            gv = cast<GlobalVariable>(cast<StoreInst>(*ai)->getPointerOperand());
+            idx = StoreInst::getPointerOperandIndex();
+        }
+        RegInfo &info = regs[gv];
+        if (!info.unsafe)
+            (*ai)->setOperand(idx, info.slot);
+    }
+
+    reload(regs, entry);
+
+    /* live-outs */
+    for (std::vector<Instruction *>::iterator ci = calls.begin(),
+            ce = calls.end(); ci != ce; ++ci) {
+        CallInst *call = cast<CallInst>(*ci);
+        storeBack(regs, call);
+        if (!call->onlyReadsMemory()) {
+            BasicBlock::iterator next(call);
+            reload(regs, ++next);
+        }
+    }
+    for (std::vector<Instruction *>::iterator ri = returns.begin(),
+            re = returns.end(); ri != re; ++ri)
+        storeBack(regs, *ri);
+
+    DBG("[PromoteRegisters] " << F.getName() << ": " << promoted <<
+            " registers, " << calls.size() << " call sites");
+    return true;
+}
@@ -0,0 +1,64 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PROMOTE_REGISTERS_H__
+#define __PROMOTE_REGISTERS_H__ 1
+
+#include <llvm/Pass.h>
+#include <llvm/Function.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/Instructions.h>
+#include <llvm/ADT/DenseMap.h>
+
+#include <vector>
+
+/*
+ * Move the register globals (R0-R12, SP, LR, PC, the flags, ...) of a
+ * recovered function into allocas, so that -mem2reg turns the register
+ * state into SSA values.
+ *
+ * The registers are loaded once at the function entry and the written
+ * ones are stored back before each return and before each call that may
+ * read them. After a call that may write memory they are reloaded. The
+ * softmmu helpers only touch guest memory and are not synchronised.
+ * Globals used in any other way than a plain load or store, including
+ * through a constant expression (e.g. load (bitcast @R0)), are left
+ * alone.
+ */
+struct PromoteRegisters: public llvm::FunctionPass {
+    static char ID;
+
+    PromoteRegisters() : llvm::FunctionPass(ID) {}
+
+    virtual bool runOnFunction(llvm::Function &F);
+private:
+    struct RegInfo {
+        llvm::AllocaInst *slot;
+        bool written;
+        bool unsafe;
+    };
+    typedef llvm::DenseMap<llvm::GlobalVariable *, RegInfo> RegMap;
+
+    static bool isMemoryHelper(llvm::Function *callee);
+    /* the globals used inside the constant expression c */
+    static void markUnsafe(RegMap &regs, llvm::Constant *c);
+    void storeBack(RegMap &regs, llvm::Instruction *before);
+    void reload(RegMap &regs, llvm::Instruction *before);
+};
+
+#endif
@@ -20,7 +20,10 @@
 
 #include "FixOverlappedBBs.h"
 #include "JumpTableInfo.h"
+#include "PassUtils.h"
 
+#include <llvm/ADT/APInt.h>
+#include <llvm/Analysis/ConstantFolding.h>
 #include <llvm/Bitcode/ReaderWriter.h>
 #include <llvm/Function.h>
 #include <llvm/Instructions.h>
@@ -31,10 +34,10 @@
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
 #include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/Local.h>
 #include <llvm/Transforms/Utils/ValueMapper.h>
 
 #include <list>
-#include <fstream>
 #include <cstring>
 
 using namespace llvm;
@@ -43,97 +46,23 @@ char ReplaceConstantLoads::ID = 0;
 static RegisterPass<ReplaceConstantLoads> X("replaceconstantloads",
         "Replace __ldl_mmu(cst) with the actual value.", false, false);
 
+static cl::opt<bool> Fixpoint("constant-fixpoint",
+        cl::desc("After the loads from constant addresses, alternate "
+            "constant folding and loads from read-only memory (-memory-ro) "
+            "until nothing changes"));
+
+static cl::opt<unsigned> FixpointMaxRounds("constant-fixpoint-max",
+        cl::desc("Give up the fixpoint after this many rounds"),
+        cl::init(16));
+
 static cl::opt<std::string> JumpTableInfoFile("jump-table-info",
         cl::desc("Json file with jump tables. Generated by jump_table.py"),
         cl::value_desc("filename"));
 
-static cl::list<std::string> MemoryDescriptors(
-        "memory",
-        cl::desc("path-to-file@0xL0ADADD7"));
-
-static cl::opt<bool> IsBigEndian("is-big-endian",
-        cl::desc("Set big endian."));
-
-ReplaceConstantLoads::MemoryPool::MemoryPool(std::string path,
-        uint64_t start)
-{
-    mp_start = start;
-
-    // open file at end
-    mp_file.open(path, std::ifstream::ate |
-            std::ifstream::in |
-            std::ifstream::binary);
-    mp_end = mp_start+(uint64_t)mp_file.tellg();
-
-    // seek to beg (just in case)
-    mp_file.seekg(0, mp_file.beg);
-
-    assert(this->mp_file.good());
-}
-
-bool
-ReplaceConstantLoads::MemoryPool::inside(uint64_t addr)
-{
-    return addr >= mp_start && addr < mp_end;
-}
-
-uint64_t
-ReplaceConstantLoads::MemoryPool::read(uint64_t addr,
-        uint8_t byteCnt,
-        bool isBigEndian = false)
-{
-    uint64_t ret = 0;
-
-    assert(inside(addr));
-    assert(byteCnt);
-    assert(byteCnt <= 8);
-    assert(inside(addr+byteCnt-1));
-
-    for (int i = 0; i < byteCnt; ++i) {
-        uint64_t pos;
-        if (isBigEndian) {
-            pos = addr+i-mp_start;
-        } else {
-            pos = addr+byteCnt-i-1-mp_start;
-        }
-        mp_file.seekg(pos, mp_file.beg);
-        assert(mp_file.good());
-        assert(!mp_file.eof());
-        unsigned char b;
-        mp_file.read((char *)&b, 1);
-        //outs() << "[ReplaceConstantLoads] Y [" << FixOverlappedBBs::hex(addr)
-        //    << "] got " << i << " - " << FixOverlappedBBs::hex(b) << "\n";
-        ret = ((uint64_t)ret << 8) | ((uint64_t)b);
-    }
-    outs() << "[ReplaceConstantLoads] load cst [" << FixOverlappedBBs::hex(addr)
-        << "] = " << FixOverlappedBBs::hex(ret) << "\n";
-
-    return ret;
-}
-
-ReplaceConstantLoads::MemoryPool *
-ReplaceConstantLoads::getMemoryPool(std::string desc)
-{
-    std::string::size_type atPos = desc.rfind('@');
-
-    assert(atPos != std::string::npos);
-    std::string path = desc.substr(0, atPos);
-    uint64_t addr = strtoll(desc.substr(atPos+1).c_str(), NULL, 16);
-
-    outs() << "[ReplaceConstantLoads] adding pool from file " <<
-        path << "@" << FixOverlappedBBs::hex(addr) << "\n";
-
-    return new MemoryPool(path, addr);
-}
-
 void ReplaceConstantLoads::initialize()
 {
-    for (auto desci = MemoryDescriptors.begin(), descie = MemoryDescriptors.end();
-            desci != descie;
-            ++desci) {
-        MemoryPool *mp = getMemoryPool(*desci);
-        m_memoryPools.push_back(mp);
-    }
+    m_memory = ConstantMemory::fromCommandLine();
+    m_fixpointLoads = 0;
 
     if (JumpTableInfoFile != "") {
         jumpTableInfoList = JumpTableInfoFactory::loadFromFile(JumpTableInfoFile);
@@ -149,16 +78,44 @@ void ReplaceConstantLoads::initialize()
         hasJumpTableInfo = false;
     }
 
-    outs() << "[ReplaceConstantLoads] loaded " << m_memoryPools.size()
+    outs() << "[ReplaceConstantLoads] loaded " << m_memory->size()
         << " constant pools\n";
-    outs() << "[ReplaceConstantLoads] endianness " << IsBigEndian << "\n";
+    outs() << "[ReplaceConstantLoads] endianness " << m_memory->isBigEndian()
+        << "\n";
 }
 
-bool ReplaceConstantLoads::runOnFunction(Function &F)
+const ReplaceConstantLoads::LoadHelper
+ReplaceConstantLoads::loadHelpers[] = {
+    {"__ldb_mmu", 1, false},
+    {"__ldw_mmu", 2, false},
+    {"__lds_mmu", 2, false},
+    {"__ldl_mmu", 4, false},
+    {"__ldq_mmu", 8, false},
+    {"__ldsb_mmu", 1, true},
+    {"__ldsw_mmu", 2, true},
+    {"__ldsl_mmu", 4, true},
+    {NULL, 0, false},
+};
+
+const ReplaceConstantLoads::LoadHelper *
+ReplaceConstantLoads::getLoadHelper(CallInst *callInst)
 {
-    std::list<llvm::Instruction *> eraseIns;
+    Function *callee = callInst->getCalledFunction();
+    if (!callee)
+        return NULL;
+    for (const LoadHelper *h = loadHelpers; h->name; ++h) {
+        if (callee->getName() == h->name)
+            return h;
+    }
+    return NULL;
+}
+
+unsigned
+ReplaceConstantLoads::replaceLoads(Function &F, bool onlyReadOnly,
+        std::list<llvm::Instruction *> &eraseIns)
+{
+    unsigned cnt = 0;
 
-    /* replace load_mmu */
     for (auto bbi = F.begin(), bbie = F.end();
             bbi != bbie;
             ++bbi) {
@@ -175,31 +132,90 @@ bool ReplaceConstantLoads::runOnFunction(Function &F)
             if (!address)
                 continue;
 
-            IntegerType *valueType = NULL;
-
-            if (callInst->getCalledFunction()->getName() ==
-                    "__ldl_mmu") {
-                valueType = llvm::Type::getInt32Ty(bbi->getContext());
-            } else if (callInst->getCalledFunction()->getName() ==
-                    "__lds_mmu") {
-                valueType = llvm::Type::getInt16Ty(bbi->getContext());
-            } else if (callInst->getCalledFunction()->getName() ==
-                    "__ldb_mmu") {
-                valueType = llvm::Type::getInt8Ty(bbi->getContext());
+            const LoadHelper *helper = getLoadHelper(callInst);
+            IntegerType *valueType = dyn_cast<IntegerType>(callInst->getType());
+            if (!helper || !valueType ||
+                    valueType->getBitWidth() < helper->byteCnt * 8)
+                continue;
+
+            Value* value = getMemoryValue(address->getZExtValue(),
+                    helper, valueType, onlyReadOnly);
+            if (!value) {
+                outs() << "[ReplaceConstantLoads] skip load from: " <<
+                    address->getZExtValue() << " -- " << *callInst <<
+                    "\n";
+                continue;
             }
-            if (valueType)  {
-                Value* value = getMemoryValue(address->getZExtValue(),
-                        valueType, IsBigEndian);
-                if (!value) {
-                    outs() << "[ReplaceConstantLoads] skip load from: " <<
-                        address->getZExtValue() << " -- " << *callInst <<
-                        "\n";
-                    continue;
-                }
-                callInst->replaceAllUsesWith(value);
-                eraseIns.push_back(callInst);
+            callInst->replaceAllUsesWith(value);
+            eraseIns.push_back(callInst);
+            ++cnt;
+        }
+    }
+    return cnt;
+}
+
+unsigned
+ReplaceConstantLoads::foldConstants(Function &F)
+{
+    unsigned cnt = 0;
+
+    for (auto bbi = F.begin(), bbie = F.end();
+            bbi != bbie;
+            ++bbi) {
+        for (auto insi = bbi->begin(), insie = bbi->end();
+                insi != insie;) {
+            Instruction *ins = insi++;
+            if (ins->use_empty())
+                continue;
+            Constant *c = ConstantFoldInstruction(ins);
+            if (!c)
+                continue;
+            ins->replaceAllUsesWith(c);
+            if (isInstructionTriviallyDead(ins))
+                ins->eraseFromParent();
+            ++cnt;
+        }
+    }
+    return cnt;
+}
+
+bool ReplaceConstantLoads::runOnFunction(Function &F)
+{
+    std::list<llvm::Instruction *> eraseIns;
+    bool folded = false;
+
+    /* replace load_mmu */
+    if (!Fixpoint) {
+        replaceLoads(F, false, eraseIns);
+    } else {
+        /* a folded load may make the address of another load constant:
+         * fold and load until nothing changes. Round 0 loads the
+         * addresses that were constant already, from any segment as
+         * without the fixpoint. The addresses that only became constant
+         * through folding are loaded from read-only memory. The loads
+         * are erased after every round so they are not found again.
+         */
+        unsigned round = 0;
+        for (; round < FixpointMaxRounds; ++round) {
+            std::list<llvm::Instruction *> roundIns;
+            unsigned foldCnt = round ? foldConstants(F) : 0;
+            unsigned loadCnt = replaceLoads(F, round > 0, roundIns);
+            for (auto insi = roundIns.begin(), insie = roundIns.end();
+                    insi != insie;
+                    ++insi) {
+                (*insi)->eraseFromParent();
             }
+            DBG("[ReplaceConstantLoads] round " << round << ": folded " <<
+                    foldCnt << ", loaded " << loadCnt);
+            folded |= foldCnt || loadCnt;
+            if (round)
+                m_fixpointLoads += loadCnt;
+            if (!loadCnt && round)
+                break;
         }
+        if (round == FixpointMaxRounds)
+            outs() << "[ReplaceConstantLoads] no fixpoint after " << round <<
+                " rounds in " << F.getName() << "\n";
     }
 
     /* annotate jump tables */
@@ -246,7 +262,7 @@ bool ReplaceConstantLoads::runOnFunction(Function &F)
             insi->setMetadata("INS_switch_idx_start", m);
             for (int i = 0; i < cnt_entries; ++i) {
                 uint64_t loadedPC = getMemoryValue(info->base_table+mul*i,
-                        4, IsBigEndian);
+                        4);
                 MDNode *m = MDNode::get(ctx, MDString::get(ctx,
                             FixOverlappedBBs::hex(
                                 loadedPC)));
@@ -265,7 +281,7 @@ bool ReplaceConstantLoads::runOnFunction(Function &F)
     }
     outs() << "[ReplaceConstantLoads] erased " << eraseIns.size() <<
         " instructions\n";
-    if (eraseIns.size() > 0) {
+    if (eraseIns.size() > 0 || folded) {
         return true;
     }
     return false;
@@ -273,46 +289,38 @@ bool ReplaceConstantLoads::runOnFunction(Function &F)
 
 uint64_t
 ReplaceConstantLoads::getMemoryValue(uint64_t address,
-        uint64_t size,
-        bool isBigEndian = false)
+        uint64_t size)
 {
-    for (auto mpi = m_memoryPools.begin(), mpie = m_memoryPools.end();
-            mpi !=  mpie;
-            ++mpi) {
-        if ((*mpi)->inside(address)) {
-            uint64_t value = (*mpi)->read(address,
-                    size, isBigEndian);
-            return value;
-        }
-    }
-    return 0xdeadbeef;
+    uint64_t value;
+    if (!m_memory->read(address, size, value))
+        return 0xdeadbeef;
+    return value;
 }
 
 llvm::Value *
 ReplaceConstantLoads::getMemoryValue(uint64_t address,
+        const LoadHelper *helper,
         llvm::IntegerType *type,
-        bool isBigEndian = false)
+        bool onlyReadOnly)
 {
-    for (auto mpi = m_memoryPools.begin(), mpie = m_memoryPools.end();
-            mpi !=  mpie;
-            ++mpi) {
-        if ((*mpi)->inside(address)) {
-            uint64_t value = (*mpi)->read(address,
-                    type->getBitWidth() / 8, isBigEndian);
-            return ConstantInt::get(type, value, false);
-        }
-    }
-    return NULL;
+    uint64_t value;
+    if (!m_memory->read(address, helper->byteCnt, value, onlyReadOnly))
+        return NULL;
+
+    APInt v(helper->byteCnt * 8, value);
+    if (helper->isSigned)
+        v = v.sext(type->getBitWidth());
+    else
+        v = v.zext(type->getBitWidth());
+    return ConstantInt::get(type->getContext(), v);
 }
 
 ReplaceConstantLoads::
 ~ReplaceConstantLoads()
 {
-    for (auto p = m_memoryPools.begin(), pe = m_memoryPools.end();
-            p != pe;
-            ++p) {
-        (*p)->mp_file.close();
-        delete *p;
-    }
+    delete m_memory;
+    if (Fixpoint)
+        outs() << "[ReplaceConstantLoads] fixpoint loads: " <<
+            m_fixpointLoads << "\n";
     outs() << "[ReplaceConstantLoads] destroy\n";
 }
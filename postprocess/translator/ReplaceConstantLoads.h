@@ -21,34 +21,38 @@
 
 #include <llvm/Pass.h>
 #include <llvm/Function.h>
+#include <llvm/Instructions.h>
 #include <llvm/Module.h>
 #include <llvm-c/Core.h>
 #include <llvm/Transforms/Utils/ValueMapper.h>
 #include <llvm/Constants.h>
 
 #include <list>
-#include <fstream>
 
+#include "ConstantMemory.h"
 #include "JumpTableInfo.h"
 
 /*
  * This pass replaces __ldl_mmu(cst) with the actual value.
  *
+ * With -constant-fixpoint, the loads from constant addresses are
+ * followed by rounds of constant folding and loads from read-only
+ * memory, until no more loads can be replaced, so a pointer read from a
+ * literal pool is dereferenced in the same run.
+ *
  * This pass can be used to discover more functions. Hence increase the
  * coverage.
  */
 struct ReplaceConstantLoads: public llvm::FunctionPass {
-    class MemoryPool {
-    public:
-        std::ifstream mp_file;
-        uint64_t mp_start;
-        uint64_t mp_end;
-        MemoryPool(std::string, uint64_t);
-        bool inside(uint64_t);
-        uint64_t read(uint64_t address, uint8_t byteCnt, bool isBigEndian);
+    struct LoadHelper {
+        const char *name;
+        unsigned byteCnt;
+        bool isSigned;
     };
+    static const LoadHelper loadHelpers[];
+
     static char ID;
-    std::list<MemoryPool *> m_memoryPools;
+    ConstantMemory *m_memory;
 
     ReplaceConstantLoads() : llvm::FunctionPass(ID) {initialize();}
     ~ReplaceConstantLoads();
@@ -56,12 +60,17 @@ struct ReplaceConstantLoads: public llvm::FunctionPass {
     virtual bool runOnFunction(llvm::Function &);
 private:
     void initialize();
-    MemoryPool *getMemoryPool(std::string);
-    llvm::Value *getMemoryValue(uint64_t, llvm::IntegerType *, bool isBigEndian);
-    uint64_t getMemoryValue(uint64_t address, uint64_t size, bool isBigEndian);
+    static const LoadHelper *getLoadHelper(llvm::CallInst *);
+    unsigned replaceLoads(llvm::Function &F, bool onlyReadOnly,
+            std::list<llvm::Instruction *> &eraseIns);
+    unsigned foldConstants(llvm::Function &F);
+    llvm::Value *getMemoryValue(uint64_t, const LoadHelper *,
+            llvm::IntegerType *, bool onlyReadOnly);
+    uint64_t getMemoryValue(uint64_t address, uint64_t size);
 
     std::list<JumpTableInfo *> jumpTableInfoList;
     std::map<uint64_t, JumpTableInfo *>  jumpTableInfoMap;
     bool hasJumpTableInfo;
+    uint64_t m_fixpointLoads;
 };
 #endif
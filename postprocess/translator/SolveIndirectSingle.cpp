@@ -18,6 +18,8 @@
 
 #include "SolveIndirectSingle.h"
 #include "FixOverlappedBBs.h"
+#include "ReplaceConstantLoads.h"
+#include "ConstantMemory.h"
 
 #include <llvm/Function.h>
 #include <llvm/Instructions.h>
@@ -35,10 +37,13 @@
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/IRReader.h>
 #include <llvm/Support/SourceMgr.h>
-#include <llvm/Support/raw_ostream.h>
+#include <llvm/PassManager.h>
+#include <llvm/Analysis/Passes.h>
 
 #include <list>
 #include <map>
+#include <set>
+#include <vector>
 #include <string>
 #include <cstdint>
 #include <iostream>
@@ -47,14 +52,15 @@
 using namespace llvm;
 
 /*
- * Input: optimised code (-gdb -basicaa) 
+ * Input: the module is cloned and optimised in memory (-basicaa -gvn)
  * Output: INS_computedValue metainfo is added to each store instruction
  * that could be solved to a single value. TODO: should we expand for
  * load instructions and for other operands?
  *
- * opt -solveindirectsingle -optfile opt-func-0.bc -optfile
- * 	opt-remainig-0.bc funcs-0.bc -o
+ * opt -solveindirectsingle -solvedfile targets.json funcs-0.bc -o
  *  	funcs-0-indirect.bc
+ *
+ * Extra already optimised modules can still be given with -optfile.
  */
 char SolveIndirectSingle::ID = 0;
 static RegisterPass<SolveIndirectSingle> X("solveindirectsingle",
@@ -62,16 +68,80 @@ static RegisterPass<SolveIndirectSingle> X("solveindirectsingle",
 
 static cl::list<std::string> OptFiles(
         "optfile",
-        cl::desc("path-to-opt-bc"));
+        cl::desc("Extra optimised module to harvest constant stores from"));
 
 static cl::opt<std::string> SolvedFile(
         "solvedfile",
         cl::desc("At this path, the newly computed targets are saved."
             "(stores to PC)."));
 
+static cl::opt<unsigned> ValueSetMax(
+        "value-set-max",
+        cl::desc("Largest set of targets tracked for an indirect store to PC "
+            "(0 disables the value-set analysis)"),
+        cl::init(16));
+
+static inline uint64_t maskToWidth(uint64_t v, unsigned bits)
+{
+    return bits >= 64 ? v : v & ((1ULL << bits) - 1);
+}
+
+static inline uint64_t signExtend(uint64_t v, unsigned bits)
+{
+    if (bits >= 64)
+        return v;
+    uint64_t sign = 1ULL << (bits - 1);
+    return (maskToWidth(v, bits) ^ sign) - sign;
+}
+
+/* the softmmu helpers touch guest memory only, not the registers */
+static bool isMemoryHelper(Function *f)
+{
+    if (!f)
+        return false;
+    StringRef name = f->getName();
+    return (name.startswith("__ld") || name.startswith("__st")) &&
+        name.endswith("_mmu");
+}
+
+SolveIndirectSingle::SolveIndirectSingle() : llvm::FunctionPass(ID)
+{
+    initialize(SolvedFile);
+}
+
 void
-SolveIndirectSingle::initialize()
+SolveIndirectSingle::initialize(const std::string &solvedFile)
+{
+    m_memory = ConstantMemory::fromCommandLine();
+
+    /* initialise the behavior */
+    m_performReplaceOnTheseGlobals[std::string("PC")] = true;
+    m_performReplaceOnTheseGlobals[std::string("thumb")] = true;
+
+    m_performAnnotationOnTheseGlobals[std::string("R0")] = true;
+    m_performAnnotationOnTheseGlobals[std::string("PC")] = true;
+    m_performAnnotationOnTheseGlobals[std::string("thumb")] = true;
+
+    this->m_solvedPCsOutStream = new
+        std::ofstream(solvedFile.c_str(), std::ios::out |
+                std::ios::binary);
+    assert(this->m_solvedPCsOutStream);
+}
+
+bool
+SolveIndirectSingle::doInitialization(Module &m)
 {
+    /* GVN on a private copy, so the module we annotate keeps its shape.
+     * The clone lives in the same context, so the harvested ConstantInts
+     * stay valid after it is gone. */
+    Module *clone = CloneModule(&m);
+    PassManager pm;
+    pm.add(createBasicAliasAnalysisPass());
+    pm.add(createGVNPass());
+    pm.run(*clone);
+    expandDirectStoresWithModule(clone);
+    delete clone;
+
     for (auto optfni = OptFiles.begin(), optfnie = OptFiles.end();
             optfni != optfnie;
             ++optfni) {
@@ -86,18 +156,7 @@ SolveIndirectSingle::initialize()
         }
     }
 
-    /* initialise the behavior */
-    m_performReplaceOnTheseGlobals[std::string("PC")] = true;
-    m_performReplaceOnTheseGlobals[std::string("thumb")] = true;
-
-    m_performAnnotationOnTheseGlobals[std::string("R0")] = true;
-    m_performAnnotationOnTheseGlobals[std::string("PC")] = true;
-    m_performAnnotationOnTheseGlobals[std::string("thumb")] = true;
-
-    this->m_solvedPCsOutStream = new
-        std::ofstream(SolvedFile.c_str(), std::ios::out |
-                std::ios::binary);
-    assert(this->m_solvedPCsOutStream);
+    return false;
 }
 
 bool
@@ -144,6 +203,8 @@ SolveIndirectSingle::performAnnotations(Function *function)
             if (!valueMap || valueMap->find(pc) == valueMap->end()) {
                 //outs() << "[SolveIndirectSingle] unable to solve " <<
                 //    *insi << "\n";
+                if (std::string("PC") == gv->getName())
+                    changed |= solveValueSet(storeInst, pc);
                 continue;
             }
             ConstantInt *replaceWith = (*valueMap)[pc];
@@ -221,6 +282,238 @@ SolveIndirectSingle::expandDirectStoresWithModule(Module *module)
     }
 }
 
+bool
+SolveIndirectSingle::getValueSet(Value *value, ValueSet &out,
+        std::set<Value *> &visiting)
+{
+    if (ConstantInt *ci = dyn_cast<ConstantInt>(value)) {
+        out.insert(ci->getZExtValue());
+        return out.size() <= ValueSetMax;
+    }
+
+    /* values depending on themselves (loops) are not bounded */
+    if (!visiting.insert(value).second)
+        return false;
+    struct VisitGuard {
+        std::set<Value *> &visiting;
+        Value *value;
+        ~VisitGuard() { visiting.erase(value); }
+    } guard = { visiting, value };
+
+    IntegerType *type = dyn_cast<IntegerType>(value->getType());
+    if (!type)
+        return false;
+    unsigned bits = type->getBitWidth();
+
+    if (PHINode *phi = dyn_cast<PHINode>(value)) {
+        for (unsigned i = 0, e = phi->getNumIncomingValues(); i != e; ++i) {
+            if (!getValueSet(phi->getIncomingValue(i), out, visiting))
+                return false;
+        }
+        return true;
+    }
+
+    if (SelectInst *select = dyn_cast<SelectInst>(value)) {
+        return getValueSet(select->getTrueValue(), out, visiting) &&
+            getValueSet(select->getFalseValue(), out, visiting);
+    }
+
+    if (CastInst *cast = dyn_cast<CastInst>(value)) {
+        IntegerType *srcType = dyn_cast<IntegerType>(cast->getSrcTy());
+        ValueSet src;
+        if (!srcType || !getValueSet(cast->getOperand(0), src, visiting))
+            return false;
+        for (ValueSet::iterator vi = src.begin(), ve = src.end(); vi != ve; ++vi) {
+            switch (cast->getOpcode()) {
+            case Instruction::ZExt:
+            case Instruction::Trunc:
+            case Instruction::BitCast:
+                out.insert(maskToWidth(*vi, bits));
+                break;
+            case Instruction::SExt:
+                out.insert(maskToWidth(
+                            signExtend(*vi, srcType->getBitWidth()), bits));
+                break;
+            default:
+                return false;
+            }
+        }
+        return out.size() <= ValueSetMax;
+    }
+
+    if (BinaryOperator *binOp = dyn_cast<BinaryOperator>(value)) {
+        ValueSet lhs, rhs;
+        if (!getValueSet(binOp->getOperand(0), lhs, visiting) ||
+                !getValueSet(binOp->getOperand(1), rhs, visiting))
+            return false;
+        for (ValueSet::iterator li = lhs.begin(), le = lhs.end(); li != le; ++li) {
+            for (ValueSet::iterator ri = rhs.begin(), re = rhs.end(); ri != re; ++ri) {
+                uint64_t a = *li, b = *ri, r;
+                switch (binOp->getOpcode()) {
+                case Instruction::Add: r = a + b; break;
+                case Instruction::Sub: r = a - b; break;
+                case Instruction::Mul: r = a * b; break;
+                case Instruction::And: r = a & b; break;
+                case Instruction::Or:  r = a | b; break;
+                case Instruction::Xor: r = a ^ b; break;
+                case Instruction::Shl:
+                    if (b >= bits)
+                        return false;
+                    r = a << b;
+                    break;
+                case Instruction::LShr:
+                    if (b >= bits)
+                        return false;
+                    r = a >> b;
+                    break;
+                case Instruction::AShr:
+                    if (b >= bits)
+                        return false;
+                    r = (uint64_t)((int64_t)signExtend(a, bits) >> b);
+                    break;
+                default:
+                    return false;
+                }
+                out.insert(maskToWidth(r, bits));
+                if (out.size() > ValueSetMax)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    if (LoadInst *load = dyn_cast<LoadInst>(value))
+        return getGlobalValueSet(load, out, visiting);
+
+    if (CallInst *call = dyn_cast<CallInst>(value))
+        return getMemoryValueSet(call, out, visiting);
+
+    return false;
+}
+
+/*
+ * A load of a register global takes the values of the closest stores to
+ * it on every path leading to the load. Reaching the function entry, or
+ * a call that may clobber the register, leaves the value unknown.
+ */
+bool
+SolveIndirectSingle::getGlobalValueSet(LoadInst *load, ValueSet &out,
+        std::set<Value *> &visiting)
+{
+    GlobalVariable *gv = dyn_cast<GlobalVariable>(load->getPointerOperand());
+    if (!gv)
+        return false;
+
+    std::set<BasicBlock *> visited;
+    std::list<std::pair<BasicBlock *, BasicBlock::iterator> > worklist;
+    worklist.push_back(std::make_pair(load->getParent(),
+                BasicBlock::iterator(load)));
+
+    while (!worklist.empty()) {
+        BasicBlock *bb = worklist.front().first;
+        BasicBlock::iterator it = worklist.front().second;
+        worklist.pop_front();
+
+        StoreInst *reaching = NULL;
+        while (it != bb->begin()) {
+            --it;
+            if (StoreInst *store = dyn_cast<StoreInst>(it)) {
+                if (store->getPointerOperand() == gv) {
+                    reaching = store;
+                    break;
+                }
+                continue;
+            }
+            if (CallInst *call = dyn_cast<CallInst>(it)) {
+                if (!call->onlyReadsMemory() &&
+                        !isMemoryHelper(call->getCalledFunction()))
+                    return false;
+            }
+        }
+
+        if (reaching) {
+            if (!getValueSet(reaching->getValueOperand(), out, visiting))
+                return false;
+            continue;
+        }
+
+        if (pred_begin(bb) == pred_end(bb))
+            return false;
+        for (pred_iterator pi = pred_begin(bb), pe = pred_end(bb); pi != pe; ++pi) {
+            if (visited.insert(*pi).second)
+                worklist.push_back(std::make_pair(*pi, (*pi)->end()));
+        }
+    }
+
+    return true;
+}
+
+/* constant pool loads: a softmmu load helper whose address has a known
+ * value set reads every one of them from the memory images */
+bool
+SolveIndirectSingle::getMemoryValueSet(CallInst *call, ValueSet &out,
+        std::set<Value *> &visiting)
+{
+    Function *callee = call->getCalledFunction();
+    IntegerType *type = dyn_cast<IntegerType>(call->getType());
+    if (!callee || !type || call->getNumArgOperands() < 1)
+        return false;
+
+    const ReplaceConstantLoads::LoadHelper *helper = NULL;
+    for (const ReplaceConstantLoads::LoadHelper *h =
+            ReplaceConstantLoads::loadHelpers; h->name; ++h) {
+        if (callee->getName() == h->name) {
+            helper = h;
+            break;
+        }
+    }
+    if (!helper)
+        return false;
+
+    ValueSet addresses;
+    if (!getValueSet(call->getArgOperand(0), addresses, visiting))
+        return false;
+    /* a value from writable memory may change at run time */
+    for (ValueSet::iterator ai = addresses.begin(), ae = addresses.end();
+            ai != ae; ++ai) {
+        uint64_t v;
+        if (!m_memory->read(*ai, helper->byteCnt, v, true))
+            return false;
+        if (helper->isSigned)
+            v = signExtend(v, helper->byteCnt * 8);
+        out.insert(maskToWidth(v, type->getBitWidth()));
+        if (out.size() > ValueSetMax)
+            return false;
+    }
+    return true;
+}
+
+bool
+SolveIndirectSingle::solveValueSet(StoreInst *storeInst, uint64_t pc)
+{
+    if (ValueSetMax == 0)
+        return false;
+
+    ValueSet targets;
+    std::set<Value *> visiting;
+    if (!getValueSet(storeInst->getValueOperand(), targets, visiting) ||
+            targets.empty())
+        return false;
+
+    LLVMContext &ctx = storeInst->getContext();
+    std::vector<Value *> mds;
+    for (ValueSet::iterator ti = targets.begin(), te = targets.end();
+            ti != te; ++ti) {
+        m_solvedPCs.push_back(*ti);
+        mds.push_back(MDString::get(ctx, FixOverlappedBBs::hex(*ti)));
+    }
+    storeInst->setMetadata("INS_computedValues", MDNode::get(ctx, mds));
+
+    outs() << "[SolveIndirectSingle] value set " << *storeInst << " pc: " <<
+        FixOverlappedBBs::hex(pc) << " -> " << targets.size() << " targets\n";
+    return true;
+}
+
 SolveIndirectSingle::~SolveIndirectSingle()
 {
     outs() << "[SolveIndirectSingle] destructor\n";
@@ -237,6 +530,7 @@ SolveIndirectSingle::~SolveIndirectSingle()
     *m_solvedPCsOutStream << "]\n";
     m_solvedPCsOutStream->close();
     delete m_solvedPCsOutStream;
+    delete m_memory;
     /* TODO: free m_directStores */
 }
 
@@ -29,12 +29,19 @@
 #include <string>
 #include <cstdint>
 #include <map>
+#include <set>
+
+class ConstantMemory;
 
 struct SolveIndirectSingle: public llvm::FunctionPass {
     static char ID;
 
-    SolveIndirectSingle() : llvm::FunctionPass(ID) {initialize();}
+    SolveIndirectSingle();
+    /* save the targets to solvedFile instead of the -solvedfile path */
+    SolveIndirectSingle(const std::string &solvedFile) :
+        llvm::FunctionPass(ID) { initialize(solvedFile); }
 
+    virtual bool doInitialization(llvm::Module &m);
     virtual bool runOnFunction(llvm::Function &f);
     ~SolveIndirectSingle();
 private:
@@ -43,8 +50,23 @@ private:
     /* map for each global (name) to its IndirectValueAtPC */
     std::map<std::string, IndirectValueAtPC *> m_directStores;
 
-    void initialize();
+    void initialize(const std::string &solvedFile);
     void expandDirectStoresWithModule(llvm::Module *module);
+
+    /* bounded value-set analysis for the stores GVN left symbolic.
+     * A set is only valid if the call returns true, false means the
+     * value is unknown or has more than -value-set-max members.
+     */
+    typedef std::set<uint64_t> ValueSet;
+    bool getValueSet(llvm::Value *value, ValueSet &out,
+            std::set<llvm::Value *> &visiting);
+    bool getGlobalValueSet(llvm::LoadInst *load, ValueSet &out,
+            std::set<llvm::Value *> &visiting);
+    bool getMemoryValueSet(llvm::CallInst *call, ValueSet &out,
+            std::set<llvm::Value *> &visiting);
+    bool solveValueSet(llvm::StoreInst *storeInst, uint64_t pc);
+    ConstantMemory *m_memory;
+
     std::map<std::string, bool> m_performReplaceOnTheseGlobals;
     std::map<std::string, bool> m_performAnnotationOnTheseGlobals;
 
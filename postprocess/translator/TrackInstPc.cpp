@@ -0,0 +1,166 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TrackInstPc.h"
+#include "FixOverlappedBBs.h"
+#include "MetaUtils.h"
+#include "PassUtils.h"
+
+#include <llvm/Instructions.h>
+#include <llvm/Constants.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <vector>
+
+using namespace llvm;
+
+char TrackInstPc::ID = 0;
+static RegisterPass<TrackInstPc> X("track-inst-pc",
+        "Track instruction PCs and drop the s2e bookkeeping in one walk",
+        false, false);
+
+MDNode *TrackInstPc::getPCNode(LLVMContext &ctx, uint64_t pc)
+{
+    MDNode *&md = m_pcNodes[pc];
+    if (!md)
+        md = MDNode::get(ctx, MDString::get(ctx, FixOverlappedBBs::hex(pc)));
+    return md;
+}
+
+bool TrackInstPc::trackFunction(Function &f)
+{
+    LLVMContext &ctx = f.getContext();
+    uint64_t pcStart = FixOverlappedBBs::getPCStartOfFunc(&f);
+    uint64_t pcEnd = FixOverlappedBBs::getPCEndOfFunc(&f);
+    uint64_t lastPc = 0;
+    MDNode *pcMeta = getPCNode(ctx, pcStart);
+    std::vector<Instruction*> eraseIns;
+    std::vector<StoreInst*> pcStores;
+
+    /* the current PC carries over from one block to the next in layout
+     * order, like -rmexterstoretopc did */
+    for (Function::iterator bbi = f.begin(), bbe = f.end(); bbi != bbe; ++bbi) {
+        bool isExitBB = isa<ReturnInst>(bbi->getTerminator());
+        StoreInst *lastStore = NULL;
+        StoreInst *lastStoreToPC = NULL;
+
+        pcStores.clear();
+
+        for (BasicBlock::iterator insi = bbi->begin(), inse = bbi->end();
+                insi != inse; ++insi) {
+            insi->setMetadata("INS_currPC", pcMeta);
+
+            if (CallInst *call = dyn_cast<CallInst>(insi)) {
+                if (m_execHandler && call->getCalledFunction() == m_execHandler)
+                    eraseIns.push_back(call);
+                continue;
+            }
+
+            StoreInst *store = dyn_cast<StoreInst>(insi);
+            if (!store)
+                continue;
+
+            Value *ptr = store->getPointerOperand();
+            if (ptr == m_PC) {
+                lastStoreToPC = store;
+                if (ConstantInt *pcValue =
+                        dyn_cast<ConstantInt>(store->getValueOperand())) {
+                    pcMeta = getPCNode(ctx, pcValue->getZExtValue());
+                    pcStores.push_back(store);
+                }
+            } else if (ptr == m_icount) {
+                /* the store right before an icount update is the PC of
+                 * the instruction that starts here */
+                assert(lastStore && lastStore->getPointerOperand() == m_PC &&
+                    "store before icount does not store to PC");
+                lastStore->setMetadata("inststart", m_instStart);
+                uint64_t pc = cast<ConstantInt>(
+                        lastStore->getValueOperand())->getZExtValue();
+                if (pc > lastPc)
+                    lastPc = pc;
+                eraseIns.push_back(store);
+            } else if (ptr == m_currentTb || ptr == m_icountBeforeTb) {
+                eraseIns.push_back(store);
+            }
+            lastStore = store;
+        }
+
+        if (!lastStoreToPC) {
+            errs() << "[TrackInstPc] basic block " <<
+                bbi->getName() << " from func " << f.getName() <<
+                " has not stores to PC\n";
+            /* FIXME: see RemoveExtraStoreToPC, currPC only follows the
+             * block layout, not the control flow */
+            continue;
+        }
+
+        /* exit blocks keep their last PC store, the rest go away */
+        for (std::vector<StoreInst*>::iterator it = pcStores.begin(),
+                ie = pcStores.end(); it != ie; ++it) {
+            if (*it == lastStoreToPC && isExitBB)
+                continue;
+            uint64_t pc = cast<ConstantInt>((*it)->getValueOperand())->getZExtValue();
+            if (!(pc >= pcStart && pc <= pcEnd)) {
+                errs() << "[TrackInstPc] outside the current BB " <<
+                    FixOverlappedBBs::hex(pc) << " [" <<
+                    FixOverlappedBBs::hex(pcStart) << " " <<
+                    FixOverlappedBBs::hex(pcEnd) << "]\n";
+            }
+            assert(pc >= pcStart && pc <= pcEnd);
+            eraseIns.push_back(*it);
+        }
+    }
+
+    if (lastPc) {
+        MDNode *mdlast = getBlockMeta(&f, "lastpc");
+        if (!mdlast || cast<ConstantInt>(mdlast->getOperand(0))->getZExtValue() < lastPc)
+            setBlockMeta(&f, "lastpc", lastPc);
+    }
+
+    for (std::vector<Instruction*>::iterator it = eraseIns.begin(),
+            ie = eraseIns.end(); it != ie; ++it)
+        (*it)->eraseFromParent();
+
+    return !eraseIns.empty() || lastPc;
+}
+
+bool TrackInstPc::runOnModule(Module &m)
+{
+    bool changed = false;
+
+    m_PC = m.getNamedGlobal("PC");
+    m_icount = m.getNamedGlobal("s2e_icount");
+    m_currentTb = m.getNamedGlobal("s2e_current_tb");
+    m_icountBeforeTb = m.getNamedGlobal("s2e_icount_before_tb");
+    m_execHandler = m.getFunction("helper_s2e_tcg_execution_handler");
+    assert(m_PC && m_icount && "globals missing");
+
+    m_pcNodes.clear();
+    m_instStart = MDNode::get(m.getContext(), NULL);
+
+    for (Module::iterator fi = m.begin(), fe = m.end(); fi != fe; ++fi) {
+        if (fi->isDeclaration())
+            continue;
+        changed |= trackFunction(*fi);
+    }
+
+    DBG("[TrackInstPc] " << m_pcNodes.size() << " distinct PCs");
+
+    return changed;
+}
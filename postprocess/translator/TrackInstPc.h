@@ -0,0 +1,59 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TRACK_INST_PC_H__
+#define __TRACK_INST_PC_H__ 1
+
+#include <llvm/Pass.h>
+#include <llvm/Module.h>
+#include <llvm/Function.h>
+#include <llvm/Metadata.h>
+#include <llvm/ADT/DenseMap.h>
+
+#include <stdint.h>
+
+/*
+ * Single forward walk replacing -tag-inst-pc, -rmexterstoretopc and
+ * -s2edeleteinstructioncount. Every instruction gets INS_currPC, the PC
+ * store right before each s2e_icount store is tagged inststart and bumps
+ * lastpc, constant PC stores are removed (except the last one of exit
+ * blocks) and the s2e bookkeeping stores/calls are erased on the way.
+ */
+struct TrackInstPc : public llvm::ModulePass {
+    static char ID;
+
+    TrackInstPc() : llvm::ModulePass(ID) {}
+
+    virtual bool runOnModule(llvm::Module &m);
+
+private:
+    /* one uniqued INS_currPC node per PC, shared by all instructions */
+    llvm::DenseMap<uint64_t, llvm::MDNode*> m_pcNodes;
+    llvm::MDNode *m_instStart;
+
+    llvm::GlobalVariable *m_PC;
+    llvm::GlobalVariable *m_icount;
+    llvm::GlobalVariable *m_currentTb;
+    llvm::GlobalVariable *m_icountBeforeTb;
+    llvm::Function *m_execHandler;
+
+    llvm::MDNode *getPCNode(llvm::LLVMContext &ctx, uint64_t pc);
+    bool trackFunction(llvm::Function &f);
+};
+
+#endif
@@ -35,46 +35,13 @@ char TransformBBToVoid::ID = 0;
 static RegisterPass<TransformBBToVoid> X("transfrombbtovoid",
         "Transform all functions to void", false, false);
 
-void
-TransformBBToVoid::copyGlobalReferences(
-        llvm::Module *module,
-        llvm::Function *func,
-        llvm::ValueToValueMapTy &valueMap)
-{
-    for (Function::iterator ibb = func->begin(), ibe = func->end();
-            ibb != ibe; ++ibb) {
-        for (BasicBlock::iterator iib = ibb->begin(), iie = ibb->end();
-                iib != iie; ++iib)
-            for (User::op_iterator iob = iib->op_begin(), ioe = iib->op_end();
-                    iob != ioe; ++iob) {
-                GlobalVariable *globalVar = dyn_cast<GlobalVariable>(*iob);
-                if (globalVar) {
-                    Constant *newGlobal =
-                        module->getOrInsertGlobal(globalVar->getName(),
-                                globalVar->getType()->getElementType());
-                    valueMap[globalVar] = newGlobal;
-                }
-                Function *globalFun = dyn_cast<Function>(*iob);
-                if (globalFun) {
-                    Constant *newGlobal =
-                        module->getOrInsertFunction(globalFun->getName(),
-                                globalFun->getFunctionType(),
-                                globalFun->getAttributes());
-                    valueMap[globalFun] = newGlobal;
-                }
-            }
-    }
-}
-
 bool TransformBBToVoid::runOnModule(Module &M)
 {
-    std::list<llvm::Instruction *> eraseIns;
     std::list<llvm::Function *>eraseFuncs;
     int count = 0;
 
     llvm::FunctionType *voidFunctionType =
         FunctionType::get(llvm::Type::getVoidTy(M.getContext()), false);
-    llvm::ValueToValueMapTy valueMap;
 
     for (Module::iterator ifunc = M.begin(), ifunce = M.end();
             ifunc != ifunce;
@@ -84,7 +51,7 @@ bool TransformBBToVoid::runOnModule(Module &M)
             /* this is an external function, rewrite only bbs */
             continue;
         if (std::strstr(oldFunc->getName().data(), "void-tcg-llvm-tb"))
-            /* already rewrote */
+            /* already rewrote (the harvester emits void blocks) */
             continue;
 
         /* crate the function with void type */
@@ -96,19 +63,22 @@ bool TransformBBToVoid::runOnModule(Module &M)
         assert(newFunc);
         assert(oldFunc->getArgumentList().size() == 1);
 
-        /* prepare map for clone function into */
+        /* the env argument is not used anymore */
         Argument *arg0 = oldFunc->getArgumentList().begin();
-        llvm::Constant *paramType = llvm::ConstantPointerNull::get((llvm::PointerType*)
-                arg0->getType());
-        valueMap[arg0] = paramType;
-
-        /* clone with a new type */
-        copyGlobalReferences(&M, oldFunc, valueMap);
+        arg0->replaceAllUsesWith(llvm::ConstantPointerNull::get(
+                    cast<llvm::PointerType>(arg0->getType())));
+
+        std::list<llvm::ReturnInst *> terms;
+        for (auto bbi = oldFunc->begin(), bbie = oldFunc->end();
+                bbi != bbie;
+                ++bbi) {
+            if (ReturnInst *ret = dyn_cast<ReturnInst>(bbi->getTerminator()))
+                terms.push_back(ret);
+        }
 
-        llvm::SmallVector<llvm::ReturnInst *, 5> terms;
-        //outs() << "[TransformBBToVoid] clone " << oldFunc->getName() << " into " <<
-        //    newFunc->getName() << "\n";
-        llvm::CloneFunctionInto(newFunc, oldFunc, valueMap, true, terms);
+        /* move the body, same module: nothing has to be remapped */
+        newFunc->getBasicBlockList().splice(newFunc->end(),
+                oldFunc->getBasicBlockList());
         ++count;
 
         LLVMContext &ctx = newFunc->getContext();
@@ -134,7 +104,7 @@ bool TransformBBToVoid::runOnModule(Module &M)
             ++func) {
         (*func)->eraseFromParent();
     }
-    outs() << "[TransformBBToVoid] cloned " << count << " functions\n";
+    outs() << "[TransformBBToVoid] moved " << count << " functions\n";
 
     if (eraseFuncs.size() > 0)
         return true;
@@ -31,6 +31,10 @@
  * introduced by qemu llvm. The return type of the function is chnaged
  * to void. Usually, this pass should runs over the newly extracted BBs
  * (at this level, each BB is represented by a function).
+ *
+ * The harvester already emits void-tcg-llvm-tb functions, this pass only
+ * rewrites older bitcode. The body is moved to the new function, not
+ * cloned.
  */
 struct TransformBBToVoid: public llvm::ModulePass {
     static char ID;
@@ -38,12 +42,6 @@ struct TransformBBToVoid: public llvm::ModulePass {
     TransformBBToVoid() : llvm::ModulePass(ID) {}
 
     virtual bool runOnModule(llvm::Module &f);
-
-private:
-    static void copyGlobalReferences(
-            llvm::Module *module,
-            llvm::Function *func,
-            llvm::ValueToValueMapTy &valueMap);
 };
 
 #endif
@@ -0,0 +1,52 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "WriteAddressMap.h"
+#include "AddressMap.h"
+
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+char WriteAddressMap::ID = 0;
+static RegisterPass<WriteAddressMap> X("write-addrmap",
+        "Write the address map of the module", false, true);
+
+static cl::opt<std::string> AddrMapFile(
+        "addrmap",
+        cl::desc("Write the address map of the module here"),
+        cl::init(""));
+
+void
+WriteAddressMap::getAnalysisUsage(AnalysisUsage &AU) const
+{
+    AU.setPreservesAll();
+}
+
+bool
+WriteAddressMap::runOnModule(Module &M)
+{
+    if (AddrMapFile.empty()) {
+        outs() << "[WriteAddressMap] no -addrmap given\n";
+        return false;
+    }
+    if (!AddressMap::write(M, AddrMapFile))
+        outs() << "[WriteAddressMap] unable to write " << AddrMapFile << "\n";
+    return false;
+}
@@ -0,0 +1,39 @@
+/* vim: set expandtab ts=4 sw=4: */
+
+/*
+ * Copyright 2017 The bin2llvm Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WRITE_ADDRESS_MAP_H__
+#define __WRITE_ADDRESS_MAP_H__ 1
+
+#include <llvm/Pass.h>
+#include <llvm/Module.h>
+
+/*
+ * Write the address map (AddressMap.h) of the module to -addrmap. Run it
+ * last, on the module that is saved, so the function indexes of the map
+ * are the ones of the saved file.
+ */
+struct WriteAddressMap : public llvm::ModulePass {
+    static char ID;
+
+    WriteAddressMap() : llvm::ModulePass(ID) {}
+
+    virtual bool runOnModule(llvm::Module &M);
+    virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
+};
+
+#endif
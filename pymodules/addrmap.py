@@ -0,0 +1,105 @@
+#!/usr/bin/evn python
+#
+# Copyright 2017 The bin2llvm Authors
+
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+
+#     http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+###############################################################################
+
+# Reader for the address map written next to final.bc by the
+# write-addrmap pass (and next to the linked module by linky). The layout
+# is documented in postprocess/translator/AddressMap.h.
+
+import bisect
+import mmap
+import struct
+import sys
+
+MAGIC = b'B2LAMAP1'
+VERSION = 1
+FLAG_THUMB = 1
+
+_HEADER = struct.Struct('<8sIIIIQQ')
+_FUNC = struct.Struct('<QQIIII')
+_RANGE = struct.Struct('<QQII')
+
+class AddressMapError(Exception):
+    pass
+
+class AddressMap(object):
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        if len(self.map) < _HEADER.size:
+            raise AddressMapError("%s: truncated header" % path)
+        magic, version, self.func_cnt, self.range_cnt, name_bytes, \
+                self.max_span, _ = _HEADER.unpack_from(self.map, 0)
+        if magic != MAGIC or version != VERSION:
+            raise AddressMapError("%s: not an address map" % path)
+        self.func_off = _HEADER.size
+        self.range_off = self.func_off + self.func_cnt * _FUNC.size
+        self.name_off = self.range_off + self.range_cnt * _RANGE.size
+        if len(self.map) < self.name_off + name_bytes:
+            raise AddressMapError("%s: truncated tables" % path)
+        # the start PCs are the only thing bisect needs
+        self.range_starts = [self._range(i)[0] \
+                for i in range(self.range_cnt)]
+        self.func_starts = [self.function(i)['start'] \
+                for i in range(self.func_cnt)]
+
+    def close(self):
+        self.map.close()
+
+    def _range(self, i):
+        return _RANGE.unpack_from(self.map, self.range_off + i * _RANGE.size)
+
+    def function(self, i):
+        start, end, index, flags, name_at, name_len = \
+                _FUNC.unpack_from(self.map, self.func_off + i * _FUNC.size)
+        name_at += self.name_off
+        return {
+            'start': start,
+            'end': end,
+            'index': index,
+            'thumb': bool(flags & FLAG_THUMB),
+            'name': self.map[name_at:name_at + name_len].decode('ascii'),
+        }
+
+    def function_at(self, pc):
+        """function whose entry is exactly pc, or None"""
+        i = bisect.bisect_left(self.func_starts, pc)
+        if i < self.func_cnt and self.func_starts[i] == pc:
+            return self.function(i)
+        return None
+
+    def functions_covering(self, pc):
+        """every function holding an instruction range with pc"""
+        found = []
+        i = bisect.bisect_right(self.range_starts, pc) - 1
+        while i >= 0 and self.range_starts[i] + self.max_span > pc:
+            start, end, func, _ = self._range(i)
+            if start <= pc < end and func not in found:
+                found.append(func)
+            i -= 1
+        return [self.function(f) for f in sorted(found)]
+
+if __name__ == '__main__':
+    if len(sys.argv) < 3:
+        print("usage: %s map.addrmap pc..." % sys.argv[0])
+        sys.exit(1)
+    amap = AddressMap(sys.argv[1])
+    for arg in sys.argv[2:]:
+        pc = int(arg, 0)
+        for f in amap.functions_covering(pc):
+            print("0x%08x %s%s" % (pc, f['name'], \
+                    ' (thumb)' if f['thumb'] else ''))
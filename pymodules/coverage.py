@@ -27,6 +27,32 @@ log = logging.getLogger(__file__)
 import re
 import json
 import argparse
+import bisect
+import struct
+
+# the IntervalSet file format (harvesting-passes/IntervalSet.h), used by
+# the harvester for coverageOut and initialAlreadyVisited, and by covset
+COVERAGE_MAGIC = b'B2LCOV01'
+
+def write_coverage_file(path, intervals):
+    """intervals are sorted, disjoint [start, end) pairs"""
+    with open(path, 'wb') as f:
+        f.write(COVERAGE_MAGIC)
+        f.write(struct.pack('<Q', len(intervals)))
+        for start, end in intervals:
+            f.write(struct.pack('<QQ', start, end))
+
+def read_coverage_file(path):
+    """[start, end) intervals of an interval set file, sorted"""
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) < 16 or data[:8] != COVERAGE_MAGIC:
+        raise ValueError("%s: not a coverage file" % path)
+    cnt, = struct.unpack_from('<Q', data, 8)
+    if len(data) < 16 + cnt * 16:
+        raise ValueError("%s: truncated" % path)
+    return [struct.unpack_from('<QQ', data, 16 + i * 16) \
+            for i in range(cnt)]
 
 def cg_load_bitcode_from_file(file_name):
     try:
@@ -95,10 +121,14 @@ class CoverageStatus:
         return self._visitedPCs
 
 class CoverageStatusQemu(object):
+    """Explored addresses, as sorted, disjoint [start, end) intervals.
+    Overlapping and adjacent intervals are coalesced, like IntervalSet
+    does."""
+
     def __init__(self):
         self._pc_re = re.compile(r'^(0x[0-9a-fA-F]{8})')
-        # sorted list of intervals (sorted by the start address)
-        self._intervals = []
+        self._starts = []
+        self._ends = []
 
     def _get_intervals_from_qemu(self, qemu_log):
         with open(qemu_log, 'rt') as f:
@@ -128,48 +158,67 @@ class CoverageStatusQemu(object):
 
             #print("new interval %s->%s" % (hex(interval_start), hex(pc_prev)))
             # this is a new interval
-            intervals.append((interval_start, pc_prev))
+            intervals.append((interval_start, pc_prev + 1))
 
             interval_start = pc_val
             pc_prev = pc_val
 
         # last interval
         if pc_val is not None:
-            intervals.append((interval_start, pc_val))
-
-        # keep the meaningful intervals
-        intervals = filter(lambda i : i[0] <= i[1], intervals)
-        return sorted(intervals, cmp=lambda a, b: a[0] - b[0])
-
-
-    def _merge_sorted_lists(self, a, b):
-        ret = []
-        while len(a) and len(b):
-            if a[0] < b[0]:
-                ret.append(a.pop(0))
+            intervals.append((interval_start, pc_val + 1))
+
+        return sorted(intervals)
+
+    def _merge(self, intervals):
+        """linear merge of [start, end) intervals"""
+        intervals = sorted(intervals)
+        ret_starts = []
+        ret_ends = []
+        a = 0
+        b = 0
+        while a < len(self._starts) or b < len(intervals):
+            if b == len(intervals) or \
+                    (a < len(self._starts) and self._starts[a] <= intervals[b][0]):
+                start, end = self._starts[a], self._ends[a]
+                a += 1
+            else:
+                start, end = intervals[b]
+                b += 1
+            if start >= end:
+                continue
+            if len(ret_ends) and start <= ret_ends[-1]:
+                ret_ends[-1] = max(ret_ends[-1], end)
             else:
-                ret.append(b.pop(0))
-        return ret + a + b
+                ret_starts.append(start)
+                ret_ends.append(end)
+        self._starts = ret_starts
+        self._ends = ret_ends
 
-    #def _prune_merge_interval(self):
-    #    # if we have two adjacdnt intervals merge them in one
-    #    ret = []
-    #    for idx in range(len(self._intervals)-1):
-    #        ret.append()
+    def extend_with_coverage_file(self, coverage_file):
+        self._merge(read_coverage_file(coverage_file))
 
     def extend_with_qemu_log(self, qemu_log):
-        r = self._get_intervals_from_qemu(qemu_log)
-        self._intervals = self._merge_sorted_lists(self._intervals, r)
-        #print(json.dumps(self._intervals, indent=1))
+        self._merge(self._get_intervals_from_qemu(qemu_log))
 
     def visited(self, pc):
-        for minPC, maxPC in self._intervals:
-            if pc >= minPC and pc <= maxPC:
-                return True
-        return False
+        idx = bisect.bisect_right(self._starts, pc) - 1
+        return idx >= 0 and pc < self._ends[idx]
 
     def get_already_explored_intervals(self):
-        return self._intervals
+        # [first, last] pairs, last included, as the json of the harvester
+        return [(s, e - 1) for s, e in zip(self._starts, self._ends)]
+
+    def save(self, path):
+        write_coverage_file(path, list(zip(self._starts, self._ends)))
+
+    def __len__(self):
+        return len(self._starts)
+
+    def copy(self):
+        ret = CoverageStatusQemu()
+        ret._starts = list(self._starts)
+        ret._ends = list(self._ends)
+        return ret
 
 def main_bc():
     parser = argparse.ArgumentParser("Build the dynamic call graph and save it to disk")
@@ -129,6 +129,8 @@ def do_elf(path_to_elf, out_dir='/tmp'):
         segm_desc['size'] = s
         segm_desc['address'] = seg.header.p_paddr - padding
         segm_desc['name'] = segm_name
+        # PF_W
+        segm_desc['readonly'] = (seg.header.p_flags & 0x2) == 0
 
         # save chunk
         save_chunk(segm_file, path_to_elf, offset, s)
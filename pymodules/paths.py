@@ -43,6 +43,9 @@ class TranslatorPaths(object):
     def get_linker(self):
         return self.get_bin('linky')
 
+    def get_pipeline(self):
+        return self.get_bin('pipey')
+
     def get_translator_so(self):
         return self.get_lib('translator.so')
 
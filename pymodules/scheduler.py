@@ -0,0 +1,257 @@
+#!/usr/bin/env python
+#
+# Copyright 2017 The bin2llvm Authors
+
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+
+#     http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+###############################################################################
+
+# Pipelined scheduling of the driver iterations (one entry point each).
+#
+# A job harvests an entry with the translator, then runs the passes on
+# what was harvested. K harvest workers and M pass workers run the jobs
+# concurrently, while this module's run() loop, on the calling thread,
+# dispatches and commits them. Jobs are numbered when dispatched and
+# committed in that order, whatever order they finish in.
+#
+# What a job sees is decided by its number only. Job n starts from a
+# snapshot of the store after the first c commits, where c is at least
+# n - (K + M - 1). With one worker of each kind, job n waits for job
+# n - 1, which is the serial driver. The entries given to the jobs, and
+# the snapshots they get, are therefore the same from run to run.
+#
+# Jobs c..n-1 may still run when job n starts. Job n does not take an
+# entry one of them already has. If one of them harvests job n's entry,
+# job n is deferred: it does not run its passes and its entry goes back
+# in the queue.
+#
+# After every commit, journal(scheduler) is called if given. resume_point()
+# is where a new scheduler (start_seq, head) would continue from: the
+# jobs not committed yet are dispatched again, from the same place in
+# the queue.
+
+import logging
+import threading
+import traceback
+try:
+    import Queue as queue
+except ImportError:
+    import queue
+
+log = logging.getLogger(__file__)
+
+class Snapshot(object):
+    def __init__(self, cov, thumb_bits, entry_cnt):
+        self.cov = cov
+        self.thumb_bits = thumb_bits
+        # only the first entry_cnt entries of the store were known
+        self.entry_cnt = entry_cnt
+
+class SharedStore(object):
+    """Coverage, thumb bits and entry queue published by the committed
+    jobs. Only the scheduler thread changes it."""
+
+    def __init__(self, cov, thumb_bits, entries):
+        self.cov = cov
+        self.thumb_bits = set(thumb_bits)
+        self.entries = list(entries)
+
+    def snapshot(self):
+        return Snapshot(self.cov.copy(), frozenset(self.thumb_bits), \
+                len(self.entries))
+
+    def add_entries(self, entries):
+        for e in entries:
+            if not self.cov.visited(e):
+                self.entries.append(e)
+
+class Job(object):
+    def __init__(self, seq, entry, base, snapshot, head):
+        self.seq = seq
+        self.entry = entry
+        # jobs base..seq-1 were not committed in snapshot
+        self.base = base
+        self.snapshot = snapshot
+        # position in the queue this job started looking from
+        self.head = head
+        self.harvest = None
+        self.result = None
+        self.deferred = False
+        self.harvested = False
+        self.finished = False
+
+class EntryScheduler(object):
+    """harvest(job) and passes(job) run on the workers, their return
+    values are kept in job.harvest and job.result. covers(job, pc) tells
+    if the harvest of job reached pc. commit(job, store) runs on the
+    scheduler thread, in job order, for the jobs that were not deferred.
+    """
+
+    def __init__(self, store, harvest, covers, passes, commit, \
+            harvest_workers=1, pass_workers=1, journal=None, \
+            start_seq=0, head=0):
+        self.store = store
+        self._harvest = harvest
+        self._covers = covers
+        self._passes = passes
+        self._commit = commit
+        self._journal = journal
+        self.harvest_workers = max(1, harvest_workers)
+        self.pass_workers = max(1, pass_workers)
+        self.window = self.harvest_workers + self.pass_workers - 1
+
+        self._events = queue.Queue()
+        self._harvest_q = queue.Queue()
+        self._pass_q = queue.Queue()
+        self._jobs = {}
+        # snapshot after i commits, for the i still usable
+        self._snapshots = {start_seq: store.snapshot()}
+        self._committed = start_seq
+        self._decided = start_seq
+        self._next_seq = start_seq
+        self._base = start_seq
+        self._head = head
+        self._pick_from = head
+
+    def _worker(self, work_q, work, kind):
+        while True:
+            job = work_q.get()
+            if job is None:
+                return
+            try:
+                ret = work(job)
+            except Exception:
+                log.warning("%s of job %d failed:\n%s" % \
+                        (kind, job.seq, traceback.format_exc()))
+                ret = None
+            self._events.put((kind, job, ret))
+
+    def _pick(self, snap, in_flight):
+        while self._head < snap.entry_cnt:
+            e = self.store.entries[self._head]
+            self._head += 1
+            if snap.cov.visited(e):
+                log.debug("[scheduler] already visited 0x%08x" % e)
+                continue
+            if e in in_flight:
+                log.debug("[scheduler] 0x%08x is in flight" % e)
+                continue
+            return e
+        return None
+
+    def resume_point(self):
+        """(start_seq, head) to continue after the committed jobs"""
+        if self._committed < self._next_seq:
+            return self._committed, self._jobs[self._committed].head
+        return self._committed, self._pick_from
+
+    def _dispatch(self, should_continue):
+        while should_continue():
+            need = max(self._base, self._next_seq - self.window + 1)
+            entry = None
+            c = need
+            while c <= self._committed:
+                snap = self._snapshots[c]
+                in_flight = set(self._jobs[m].entry \
+                        for m in range(c, self._next_seq))
+                entry = self._pick(snap, in_flight)
+                if entry is not None:
+                    break
+                c += 1
+            if entry is None:
+                # wait for a commit to publish more entries
+                self._base = min(c, self._committed)
+                return
+            self._base = c
+            for old in [s for s in self._snapshots if s < c]:
+                del self._snapshots[old]
+            job = Job(self._next_seq, entry, c, snap, self._pick_from)
+            self._pick_from = self._head
+            self._jobs[job.seq] = job
+            self._next_seq += 1
+            self._harvest_q.put(job)
+
+    def _decide(self):
+        # in job order, so the jobs below were decided already
+        while self._decided < self._next_seq and \
+                self._jobs[self._decided].harvested:
+            job = self._jobs[self._decided]
+            self._decided += 1
+            for m in range(job.base, job.seq):
+                lower = self._jobs[m]
+                if not lower.deferred and lower.harvest is not None and \
+                        self._covers(lower, job.entry):
+                    log.debug("[scheduler] job %d defers 0x%08x to job %d" % \
+                            (job.seq, job.entry, m))
+                    job.deferred = True
+                    job.finished = True
+                    break
+            if not job.deferred:
+                self._pass_q.put(job)
+
+    def _commit_ready(self):
+        while self._committed < self._next_seq and \
+                self._jobs[self._committed].finished:
+            job = self._jobs[self._committed]
+            if job.deferred:
+                self.store.add_entries([job.entry])
+            else:
+                self._commit(job, self.store)
+            job.snapshot = None
+            self._committed += 1
+            self._snapshots[self._committed] = self.store.snapshot()
+            if self._journal is not None:
+                self._journal(self)
+        # the later jobs only look back to their base
+        low = min([self._base, self._committed] + \
+                [self._jobs[s].base \
+                for s in range(self._decided, self._next_seq)])
+        for old in [s for s in self._jobs if s < low]:
+            del self._jobs[old]
+
+    def run(self, should_continue):
+        threads = []
+        for i in range(self.harvest_workers):
+            threads.append(threading.Thread(target=self._worker, \
+                    args=(self._harvest_q, self._harvest, 'harvest')))
+        for i in range(self.pass_workers):
+            threads.append(threading.Thread(target=self._worker, \
+                    args=(self._pass_q, self._passes, 'passes')))
+        for t in threads:
+            t.daemon = True
+            t.start()
+
+        try:
+            while True:
+                self._dispatch(should_continue)
+                if self._committed == self._next_seq:
+                    break
+                try:
+                    # a timeout keeps ^C deliverable on python 2
+                    kind, job, ret = self._events.get(True, 1)
+                except queue.Empty:
+                    continue
+                if kind == 'harvest':
+                    job.harvest = ret
+                    job.harvested = True
+                else:
+                    job.result = ret
+                    job.finished = True
+                self._decide()
+                self._commit_ready()
+        finally:
+            for i in range(self.harvest_workers):
+                self._harvest_q.put(None)
+            for i in range(self.pass_workers):
+                self._pass_q.put(None)
+        return self._committed
@@ -47,6 +47,8 @@ ln -fs "${src_dir}/harvesting-passes" "${s2e_dir}/qemu/s2e/Plugins/bin2llvm"
 
 ln -fs "${src_dir}/harvesting-passes/JumpTableInfo.cpp" "${src_dir}/postprocess/translator/JumpTableInfo.cpp"
 ln -fs "${src_dir}/harvesting-passes/JumpTableInfo.h" "${src_dir}/postprocess/translator/JumpTableInfo.h"
+ln -fs "${src_dir}/harvesting-passes/IntervalSet.cpp" "${src_dir}/postprocess/translator/IntervalSet.cpp"
+ln -fs "${src_dir}/harvesting-passes/IntervalSet.h" "${src_dir}/postprocess/translator/IntervalSet.h"
 
 
 make -f ${src_dir}/third_party/s2e/Makefile
@@ -58,6 +58,8 @@ cp -vp "${build_dir}/opt/lib/"* "${lib_dir}"
 
 # linky and translator
 cp -vp "${build_dir}/bin2llvm-postprocess-build/linker/linky" "${bin_dir}"
+cp -vp "${build_dir}/bin2llvm-postprocess-build/pipeline/pipey" "${bin_dir}"
+cp -vp "${build_dir}/bin2llvm-postprocess-build/covset/covset" "${bin_dir}"
 cp -vp "${build_dir}/bin2llvm-postprocess-build/translator/translator.so" "${lib_dir}"
 cp -vp "${src_dir}/postprocess/translator/mem-ops-alt.ll" "${lib_dir}"
 
@@ -0,0 +1,18 @@
+Feature: Check the address map of final.bc
+
+	Background:
+		Given the binary "./armle-func/multiple-func.armle.c.bin" of type "raw-arm-le"
+		Given the entry point "0x0"
+		When translator runs with random output directory
+
+	Scenario: Check the lookup of function entries
+		Then an out file named "final.bc.addrmap" should exist
+		When addrmap looks up "0x0 0x1c 0xa4" in "final.bc.addrmap"
+		Then the output should contain "0x00000000 Function_0x00000000"
+		Then the output should contain "0x0000001c Function_0x0000001c"
+		Then the output should contain "0x000000a4 Function_0x000000a4"
+
+	Scenario: Check the lookup of a PC inside a function
+		When addrmap looks up "0x20" in "final.bc.addrmap"
+		Then the output should contain "0x00000020 Function_0x0000001c"
+		Then the output should not contain "0x00000020 Function_0x00000000"
@@ -0,0 +1,15 @@
+Feature: Check that the incremental link gives the functions of a full link
+
+	Background:
+		Given the binary "./armle-func/multiple-func.armle.c.bin" of type "raw-arm-le"
+		Given the entry point "0x0"
+		When translator runs with random output directory
+		Given the output directory is kept as "full"
+
+	Scenario: Check the functions of an incremental link run twice
+		When translator runs with random output directory and options "--incremental-link"
+		When translator runs again in the same output directory with options "--incremental-link"
+		Then an out file named "final-linked.bc" should exist
+		Given llvm file of "final-linked.bc" of "full"
+		Given llvm file of "final-linked.bc"
+		Then the out file "final-linked.ll" should define the same functions as in "full"
@@ -0,0 +1,15 @@
+Feature: Check that a resumed run gives the final.bc of a whole run
+
+	Background:
+		Given the binary "./armle-func/multiple-func.armle.c.bin" of type "raw-arm-le"
+		Given the entry point "0x0"
+		When translator runs with random output directory
+		Given the output directory is kept as "whole"
+
+	Scenario: Check final.bc after --resume
+		When translator is killed once "journal.json" exists, with options ""
+		When translator runs again in the same output directory with options "--resume"
+		Then an out file named "final.bc" should exist
+		Given llvm file of "final.bc" of "whole"
+		Given llvm file of "final.bc"
+		Then the out file "final.ll" should be the same as in "whole"
@@ -19,26 +19,53 @@ Given(/^the load address "(.*?)"$/) do |addr|
 end
 
 When(/^translator runs with random output directory$/) do
-	@tmp_dir=Dir.mktmpdir('translator-testing-'+
-						  File.basename(@input_binary_path)+'-')
-	announce_or_puts('Using ' + @tmp_dir + ' as temporary directory')
-	cmd=@path.get_translator+
-		" --type " + @binary_type +
-		" --file " + @input_binary_path +
-		" --temp-dir " + @tmp_dir
-	if @binary_entry.nil?
-		@binary_entry = "0x0"
-	end
-	if not @binary_load.nil?
-		cmd = cmd + " --load-address " + @binary_load
-	end
-	cmd = cmd + " --entry " + @binary_entry
+	@tmp_dir=new_tmp_dir
+	cmd=translator_cmd("")
 	announce_or_puts("Running: " + cmd)
 	run_simple(unescape(cmd), true, 100)
 	#announce_or_puts('done translation')
 	#cd(@tmp_dir)
 end
 
+When(/^translator runs with random output directory and options "(.*?)"$/) do |options|
+	@tmp_dir=new_tmp_dir
+	cmd=translator_cmd(options)
+	announce_or_puts("Running: " + cmd)
+	run_simple(unescape(cmd), true, 100)
+end
+
+When(/^translator runs again in the same output directory with options "(.*?)"$/) do |options|
+	cmd=translator_cmd(options)
+	announce_or_puts("Running: " + cmd)
+	run_simple(unescape(cmd), true, 100)
+end
+
+When(/^translator is killed once "(.*?)" exists, with options "(.*?)"$/) do |file, options|
+	@tmp_dir=new_tmp_dir
+	cmd=translator_cmd(options)
+	announce_or_puts("Running: " + cmd)
+	# in its own process group, so qemu and opt die with it; from where
+	# aruba runs its commands, as the install dir may be relative
+	pid=Process.spawn(unescape(cmd), :pgroup => true, :chdir => current_dir,
+					  [:out, :err] => [@tmp_dir+"/killed.log", "w"])
+	file_path=File.absolute_path(@tmp_dir+"/"+file)
+	while not File.exist?(file_path)
+		break if Process.waitpid(pid, Process::WNOHANG)
+		sleep 0.1
+	end
+	begin
+		Process.kill('KILL', -pid)
+		Process.waitpid(pid)
+	rescue Errno::ESRCH, Errno::ECHILD
+		# it was already done
+	end
+end
+
+Given(/^the output directory is kept as "(.*?)"$/) do |name|
+	@kept_dirs ||= {}
+	@kept_dirs[name]=@tmp_dir
+end
+
 Then(/^the out file "(.*?)" should not be empty$/) do |file|
 	if File.size(@test_dir+'/'+file) == 0
 		raise "empty file"
@@ -70,3 +97,32 @@ Given(/^unified "(.*?)" in "(.*?)"$/) do |file_glob, file_out|
 	cmd="bash -c \"" + cmd + "\""
 	run_simple(cmd, true, 20)
 end
+
+Given(/^llvm file of "(.*?)" of "(.*?)"$/) do |file, name|
+	bc_file_path=File.absolute_path(@kept_dirs[name]+"/"+file)
+	bc_to_ll(bc_file_path, nil)
+end
+
+When(/^addrmap looks up "(.*?)" in "(.*?)"$/) do |pcs, file|
+	file_path=File.absolute_path(@tmp_dir+"/"+file)
+	check_file_presence([file_path], true)
+	cmd="python " + @path.get_addrmap + " " + file_path + " " + pcs
+	run_simple(unescape(cmd), true, 20)
+end
+
+Then(/^the out file "(.*?)" should define the same functions as in "(.*?)"$/) do |file, name|
+	defs=ll_defines(File.absolute_path(@tmp_dir+"/"+file))
+	kept=ll_defines(File.absolute_path(@kept_dirs[name]+"/"+file))
+	if defs != kept
+		raise "functions differ from " + name + ": " +
+			(defs - kept).join(", ") + " / " + (kept - defs).join(", ")
+	end
+end
+
+Then(/^the out file "(.*?)" should be the same as in "(.*?)"$/) do |file, name|
+	body=ll_body(File.absolute_path(@tmp_dir+"/"+file))
+	kept=ll_body(File.absolute_path(@kept_dirs[name]+"/"+file))
+	if body != kept
+		raise "out file " + file + " differs from the one in " + name
+	end
+end
@@ -48,6 +48,50 @@ class TranslatorPaths
 	def get_translator()
 		return self.get_bin('bin2llvm.py')
 	end
+
+	def get_addrmap()
+		return self.get_bin(File.join('bin2llvm-pymodules', 'addrmap.py'))
+	end
+end
+
+def new_tmp_dir()
+	tmp_dir=Dir.mktmpdir('translator-testing-'+
+						 File.basename(@input_binary_path)+'-')
+	announce_or_puts('Using ' + tmp_dir + ' as temporary directory')
+	return tmp_dir
+end
+
+def translator_cmd(options)
+	cmd=@path.get_translator+
+		" --type " + @binary_type +
+		" --file " + @input_binary_path +
+		" --temp-dir " + @tmp_dir +
+		" --qemu-log"
+	if @binary_entry.nil?
+		@binary_entry = "0x0"
+	end
+	if not @binary_load.nil?
+		cmd = cmd + " --load-address " + @binary_load
+	end
+	cmd = cmd + " --entry " + @binary_entry
+	if not options.empty?
+		cmd = cmd + " " + options
+	end
+	return cmd
+end
+
+# names of the functions defined in a .ll file, sorted
+def ll_defines(file)
+	check_file_presence([file], true)
+	return File.readlines(file).grep(/^define /).map { |l|
+		l[/@[^(]*/]
+	}.sort
+end
+
+# a .ll file without its ModuleID, which holds the path
+def ll_body(file)
+	check_file_presence([file], true)
+	return File.readlines(file).reject { |l| l.start_with?('; ModuleID') }
 end
 
 def bc_to_ll(filein, fileout)